@@ -0,0 +1,308 @@
+/** \file average.c
+ * \brief Ensemble averaging of many traces with the same setup
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup average Ensemble averaging
+ *
+ * Every trace is streamed once through the accumulators and can be
+ * dropped afterwards, the memory does not grow with the number of
+ * traces. The accumulators are kept in a state file, so an average is
+ * continued by later runs without touching the earlier traces.
+ *
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "average.h"
+
+
+/** Magic of the state file format (including the format version) */
+static const char average_magic[8] = "DSOAVG1";
+
+
+/** On disk header of an average state file */
+typedef struct {
+  char magic[8];
+  uint64_t n;
+  uint64_t count;
+  double sample_rate;
+  double trigger_delay;
+  double mesial_voltage;
+  double offset_voltage;
+  int32_t timebase;
+  int32_t variable_volts;
+  char dso_type[32];
+} average_header_t;
+
+
+/** Allocate zeroed accumulators for traces of n samples */
+static bool average_alloc(average_t *avg, const size_t n)
+{
+  avg->n = n;
+  avg->sum = calloc(n > 0 ? n : 1, sizeof(uint64_t));
+  avg->sum2 = calloc(n > 0 ? n : 1, sizeof(uint64_t));
+  avg->min = malloc(n > 0 ? n : 1);
+  avg->max = calloc(n > 0 ? n : 1, 1);
+  if ((avg->sum == NULL) || (avg->sum2 == NULL) || (avg->min == NULL) || (avg->max == NULL)) {
+    printf("average: out of memory\n");
+    return false;
+  }
+  memset(avg->min, 0xff, n);
+  return true;
+}
+
+
+/* documented in average.h */
+bool average_load(average_t *avg, const char *file)
+{
+  average_header_t h;
+
+  memset(avg, 0, sizeof(*avg));
+  FILE *fd = fopen(file, "r");
+  if (fd == NULL) {
+    return true;
+  }
+  bool ok = (fread(&h, sizeof(h), 1, fd) == 1) &&
+            (memcmp(h.magic, average_magic, sizeof(average_magic)) == 0) &&
+            average_alloc(avg, (size_t)h.n);
+  if (ok) {
+    ok = (fread(avg->sum, sizeof(uint64_t), avg->n, fd) == avg->n) &&
+         (fread(avg->sum2, sizeof(uint64_t), avg->n, fd) == avg->n) &&
+         (fread(avg->min, 1, avg->n, fd) == avg->n) &&
+         (fread(avg->max, 1, avg->n, fd) == avg->n);
+  }
+  fclose(fd);
+  if (!ok) {
+    printf("%s is not a valid average state\n", file);
+    average_free(avg);
+    return false;
+  }
+  avg->count = h.count;
+  famos_trace_t *t = &avg->header;
+  t->has_xaxis = true;
+  t->has_yaxis = true;
+  t->sample_rate = h.sample_rate;
+  t->trigger_delay = h.trigger_delay;
+  t->mesial_voltage = h.mesial_voltage;
+  t->offset_voltage = h.offset_voltage;
+  t->timebase = h.timebase;
+  t->variable_volts = h.variable_volts;
+  memcpy(t->dso_type, h.dso_type, sizeof(t->dso_type));
+  t->dso_type[sizeof(t->dso_type) - 1] = '\0';
+  t->num_samples = avg->n;
+  return true;
+}
+
+
+/* documented in average.h */
+bool average_save(const average_t *avg, const char *file)
+{
+  average_header_t h;
+  const size_t tmplen = strlen(file) + sizeof(".tmp");
+  char *tmpfile = malloc(tmplen);
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, average_magic, sizeof(average_magic));
+  h.n = avg->n;
+  h.count = avg->count;
+  h.sample_rate = avg->header.sample_rate;
+  h.trigger_delay = avg->header.trigger_delay;
+  h.mesial_voltage = avg->header.mesial_voltage;
+  h.offset_voltage = avg->header.offset_voltage;
+  h.timebase = avg->header.timebase;
+  h.variable_volts = avg->header.variable_volts;
+  memcpy(h.dso_type, avg->header.dso_type, sizeof(h.dso_type));
+
+  if (tmpfile == NULL) {
+    printf("average: out of memory\n");
+    return false;
+  }
+  snprintf(tmpfile, tmplen, "%s.tmp", file);
+  FILE *fd = fopen(tmpfile, "w");
+  if (fd == NULL) {
+    printf("cannot write average state %s\n", tmpfile);
+    free(tmpfile);
+    return false;
+  }
+  bool ok = (fwrite(&h, sizeof(h), 1, fd) == 1) &&
+            (fwrite(avg->sum, sizeof(uint64_t), avg->n, fd) == avg->n) &&
+            (fwrite(avg->sum2, sizeof(uint64_t), avg->n, fd) == avg->n) &&
+            (fwrite(avg->min, 1, avg->n, fd) == avg->n) &&
+            (fwrite(avg->max, 1, avg->n, fd) == avg->n);
+  ok = (fclose(fd) == 0) && ok;
+  if (ok) {
+    ok = (rename(tmpfile, file) == 0);
+  }
+  if (!ok) {
+    printf("cannot write average state %s\n", file);
+    remove(tmpfile);
+  }
+  free(tmpfile);
+  return ok;
+}
+
+
+/* documented in average.h */
+void average_free(average_t *avg)
+{
+  free(avg->sum);
+  free(avg->sum2);
+  free(avg->min);
+  free(avg->max);
+  memset(avg, 0, sizeof(*avg));
+}
+
+
+/* documented in average.h */
+bool average_matches(const average_t *avg, const famos_trace_t *trace)
+{
+  const famos_trace_t *h = &avg->header;
+  return (trace->num_samples == avg->n) &&
+         (trace->sample_rate == h->sample_rate) &&
+         (trace->trigger_delay == h->trigger_delay) &&
+         (trace->mesial_voltage == h->mesial_voltage) &&
+         (trace->offset_voltage == h->offset_voltage) &&
+         (trace->variable_volts == h->variable_volts);
+}
+
+
+static bool average_open(sink_t *sink, const sink_source_t *src)
+{
+  average_t *avg = sink->state;
+  const famos_trace_t *trace = src->trace;
+
+  avg->skip = false;
+  if (trace->samples == NULL) {
+    printf("Note: only raw track files can be averaged\n");
+    avg->skip = true;
+  } else if (avg->count == 0) {
+    /* the first trace defines the setup */
+    average_free(avg);
+    if (!average_alloc(avg, trace->num_samples)) {
+      return false;
+    }
+    avg->header = *trace;
+    avg->header.samples = NULL;
+  } else if (!average_matches(avg, trace)) {
+    printf("Note: setup differs from the averaged traces - not averaged\n");
+    avg->skip = true;
+  }
+  return true;
+}
+
+
+/** Add a block of codes to the accumulators (vectorised by the compiler) */
+static void average_kernel(const uint8_t * restrict c, uint64_t * restrict sum,
+                           uint64_t * restrict sum2, uint8_t * restrict min,
+                           uint8_t * restrict max, const size_t n)
+{
+  for (size_t i = 0; i < n; i++) {
+    const uint32_t x = c[i];
+    sum[i] += x;
+    sum2[i] += x*x;
+    min[i] = (c[i] < min[i]) ? c[i] : min[i];
+    max[i] = (c[i] > max[i]) ? c[i] : max[i];
+  }
+}
+
+
+static void average_write(sink_t *sink, const sink_block_t *blk)
+{
+  average_t *avg = sink->state;
+  if (avg->skip) {
+    return;
+  }
+  const size_t i = blk->first;
+  average_kernel(blk->codes, avg->sum + i, avg->sum2 + i, avg->min + i, avg->max + i, blk->n);
+}
+
+
+static bool average_close(sink_t *sink, const sink_source_t *src)
+{
+  (void)src;
+  average_t *avg = sink->state;
+  if (!avg->skip) {
+    avg->count++;
+    printf("Averaged traces: %llu\n", (unsigned long long)avg->count);
+  }
+  return true;
+}
+
+
+/* documented in average.h */
+void average_sink(sink_t *sink, average_t *avg)
+{
+  memset(sink, 0, sizeof(*sink));
+  sink->name = "average";
+  sink->open = average_open;
+  sink->write = average_write;
+  sink->close = average_close;
+  sink->state = avg;
+  sink->codes_only = true;
+}
+
+
+/* documented in average.h */
+bool average_write_csv(const average_t *avg, const char *file)
+{
+  const famos_trace_t *h = &avg->header;
+  const double n = (avg->count > 0) ? (double)avg->count : 1.0;
+  const double lsb = h->mesial_voltage/128.0;
+  /* the date of the first trace does not apply to the ensemble */
+  famos_trace_t setup = *h;
+  setup.date[0] = '\0';
+  setup.time[0] = '\0';
+
+  printf("Exporting average of %llu traces: %s\n", (unsigned long long)avg->count, file);
+  FILE *fd = fopen(file, "w");
+  if (fd == NULL) {
+    printf("cannot write %s\n", file);
+    return false;
+  }
+  setvbuf(fd, NULL, _IOFBF, 256*1024);
+  famos_write_csv_header(fd, &setup);
+  fprintf(fd, "#Averaged traces:   \t%llu\n", (unsigned long long)avg->count);
+  fprintf(fd, "#Time [s] \t Mean [V] \t Std deviation [V] \t Minimum [V] \t Maximum [V]\n");
+  for (size_t i = 0; i < avg->n; i++) {
+    const double mean = (double)avg->sum[i]/n;
+    const double var = (double)avg->sum2[i]/n - mean*mean;
+    fprintf(fd, "%.7e \t %.7e \t %.7e \t %.7e \t %.7e\n",
+            famos_time(h, i),
+            lsb*(mean - 128.0) - h->offset_voltage,
+            fabs(lsb)*sqrt(var > 0.0 ? var : 0.0),
+            famos_voltage(h, avg->min[i]),
+            famos_voltage(h, avg->max[i]));
+  }
+  return (fclose(fd) == 0);
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
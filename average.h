@@ -0,0 +1,100 @@
+/** \file average.h
+ * \brief Ensemble averaging of many traces with the same setup interface
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup average
+ * @{
+ */
+
+#ifndef AVERAGE_H
+#define AVERAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "famos.h"
+#include "sink.h"
+
+
+/** Per sample accumulators of the 8 bit codes of all averaged traces.
+ *
+ * The accumulators are integers, hence the result does not depend on
+ * the order of the traces and adding a trace never loses precision.
+ */
+typedef struct {
+  /** setup of the first trace (samples is NULL), all others have to match */
+  famos_trace_t header;
+  /** number of samples per trace */
+  size_t n;
+  /** number of averaged traces */
+  uint64_t count;
+  /** sum of the codes */
+  uint64_t *sum;
+  /** sum of the squared codes */
+  uint64_t *sum2;
+  /** smallest and largest code */
+  uint8_t *min;
+  uint8_t *max;
+  /** the trace currently fed by the sink is not added */
+  bool skip;
+} average_t;
+
+
+/** Load the accumulators, a missing file yields an empty average.
+ *
+ * \return false if the file exists but is no valid average state
+ */
+bool average_load(average_t *avg, const char *file);
+
+
+/** Store the accumulators (via a temporary file which is renamed) */
+bool average_save(const average_t *avg, const char *file);
+
+
+/** Release the memory of an average */
+void average_free(average_t *avg);
+
+
+/** Check whether a trace has the CD/CR setup and length of the average */
+bool average_matches(const average_t *avg, const famos_trace_t *trace);
+
+
+/** Register a sink which adds the codes of a trace to the average.
+ *
+ * A trace whose setup does not match is skipped with a note.
+ */
+void average_sink(sink_t *sink, average_t *avg);
+
+
+/** Write time, mean, standard deviation, minimum and maximum (volts) as CSV */
+bool average_write_csv(const average_t *avg, const char *file);
+
+
+/** @} */
+
+#endif /* !AVERAGE_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,357 @@
+/** \file bench.c
+ * \brief Conversion micro benchmarks on synthetic track files
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup bench Conversion benchmarks
+ *
+ * Times the track file parser, the sample decoder of the output sinks,
+ * the CSV sink and convert_and_save_disc(), the conversion run after a
+ * download which also stores the raw track file. Every
+ * stage runs until it took at least BENCH_MIN_TIME, the fastest run is
+ * reported. The results are compared against a baseline file, a stage
+ * which got slower by more than BENCH_TOLERANCE fails the run.
+ *
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "famos.h"
+#include "sink.h"
+#include "synth.h"
+#include "convert.h"
+
+
+/** Minimum accumulated time per stage in seconds */
+#define BENCH_MIN_TIME 0.5
+
+/** Minimum number of runs per stage */
+#define BENCH_MIN_RUNS 3
+
+/** Allowed slow down against the baseline */
+#define BENCH_TOLERANCE 0.10
+
+
+typedef struct {
+  const char *name;
+  /** fastest run in seconds */
+  double seconds;
+  double ns_per_sample;
+  double mb_per_s;
+} bench_result_t;
+
+
+/** State of one benchmark run */
+typedef struct {
+  const char *file;
+  const char *buf;
+  size_t count;
+  famos_trace_t trace;
+  size_t num_samples;
+  /** track file written by convert_and_save_disc() */
+  const char *out_file;
+  double checksum;
+} bench_t;
+
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + 1e-9*(double)ts.tv_nsec;
+}
+
+
+/** Route stdout to /dev/null (the sinks report every export), returns the old stdout */
+static int mute(void)
+{
+  fflush(stdout);
+  const int saved = dup(STDOUT_FILENO);
+  const int null = open("/dev/null", O_WRONLY);
+  if (null >= 0) {
+    dup2(null, STDOUT_FILENO);
+    close(null);
+  }
+  return saved;
+}
+
+
+static void unmute(const int saved)
+{
+  fflush(stdout);
+  if (saved >= 0) {
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+  }
+}
+
+
+/* ---- stages ---- */
+
+static void stage_parse(bench_t *b)
+{
+  famos_trace_t trace;
+  if (!famos_parse(b->buf, b->count, &trace)) {
+    printf("bench: synthetic track file not recognised\n");
+    exit(EXIT_FAILURE);
+  }
+  b->checksum += (double)trace.num_samples;
+}
+
+
+/** Sink which only reads the decoded block */
+static void touch_write(sink_t *sink, const sink_block_t *blk)
+{
+  double *sum = sink->state;
+  for (size_t i = 0; i < blk->n; i++) {
+    *sum += blk->t[i] + blk->v[i];
+  }
+}
+
+
+static bool touch_open(sink_t *sink, const sink_source_t *src)
+{
+  (void)sink;
+  (void)src;
+  return true;
+}
+
+
+static void stage_run_sinks(bench_t *b, sink_t *sinks, const size_t n)
+{
+  sink_source_t src;
+  memset(&src, 0, sizeof(src));
+  src.file = b->file;
+  src.trace = &b->trace;
+  src.num_samples = b->num_samples;
+  if (!sink_run(sinks, n, &src)) {
+    printf("bench: conversion failed\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+static void stage_convert(bench_t *b)
+{
+  sink_t sink = { "touch", touch_open, touch_write, NULL, NULL, &b->checksum, false };
+  stage_run_sinks(b, &sink, 1);
+}
+
+
+static void stage_csv(bench_t *b)
+{
+  sink_opt_t opt;
+  sink_t sinks[SINK_MAX];
+  memset(&opt, 0, sizeof(opt));
+  opt.csv = true;
+  const int saved = mute();
+  stage_run_sinks(b, sinks, sink_select(sinks, &opt));
+  unmute(saved);
+}
+
+
+/** Conversion after a download: raw track file and CSV in one pass */
+static void stage_save(bench_t *b)
+{
+  convopt_t convopt;
+  memset(&convopt, 0, sizeof(convopt));
+  convopt.outputs.csv = true;
+  const int saved = mute();
+  convert_and_save_disc(b->out_file, b->buf, b->count, &convopt);
+  unmute(saved);
+}
+
+
+/** Run a stage until BENCH_MIN_TIME and BENCH_MIN_RUNS are reached */
+static bench_result_t run_stage(bench_t *b, const char *name, void (*stage)(bench_t *))
+{
+  bench_result_t r = { name, 1e30, 0.0, 0.0 };
+  double total = 0.0;
+  for (int runs = 0; (runs < BENCH_MIN_RUNS) || (total < BENCH_MIN_TIME); runs++) {
+    const double t0 = now();
+    stage(b);
+    const double dt = now() - t0;
+    total += dt;
+    r.seconds = (dt < r.seconds) ? dt : r.seconds;
+  }
+  r.ns_per_sample = 1e9*r.seconds/(double)b->num_samples;
+  r.mb_per_s = (double)b->count/r.seconds/1e6;
+  return r;
+}
+
+
+/** ns/sample of a stage in the baseline file, 0 if missing */
+static double baseline_value(const char *file, const char *name)
+{
+  FILE *fd = fopen(file, "r");
+  char line[256], key[64];
+  double value = 0.0, v;
+  if (fd == NULL) {
+    return 0.0;
+  }
+  while (fgets(line, sizeof(line), fd) != NULL) {
+    if ((line[0] != '#') && (sscanf(line, "%63s %lf", key, &v) == 2) && (strcmp(key, name) == 0)) {
+      value = v;
+    }
+  }
+  fclose(fd);
+  return value;
+}
+
+
+static bool save_baseline(const char *file, const bench_result_t *r, const size_t n,
+                          const size_t num_samples)
+{
+  FILE *fd = fopen(file, "w");
+  if (fd == NULL) {
+    return false;
+  }
+  fprintf(fd, "# dso_bench baseline, %zu samples, ns/sample per stage\n", num_samples);
+  for (size_t i = 0; i < n; i++) {
+    fprintf(fd, "%s %.4f\n", r[i].name, r[i].ns_per_sample);
+  }
+  return (fclose(fd) == 0);
+}
+
+
+static void print_help(void)
+{
+  printf("\n  SYNOPSIS\n");
+  printf("         dso_bench [-n samples] [-s shape] [-b baseline] [-u] [-t dir]\n\n");
+  printf("  OPTIONS\n");
+  printf("         -n samples   length of the synthetic trace (default 1000000, at most %d)\n",
+         SYNTH_MAX_SAMPLES);
+  printf("         -s shape     synthetic trace, see dso_serial -G (default sine)\n");
+  printf("         -b baseline  baseline file (default bench.baseline), written by the\n");
+  printf("                      first run on a machine\n");
+  printf("         -u           write the results as new baseline\n");
+  printf("         -t dir       directory of the temporary files (default /tmp)\n\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+  const char *baseline = "bench.baseline";
+  const char *dir = "/tmp";
+  const char *shape = "sine";
+  size_t num_samples = 1000000;
+  bool update = false;
+  bench_t b;
+  int opt;
+
+  memset(&b, 0, sizeof(b));
+  while ((opt = getopt(argc, argv, "n:s:b:ut:h")) != -1) {
+    switch (opt) {
+      case 'n': num_samples = strtoul(optarg, NULL, 10); break;
+      case 's': shape = optarg; break;
+      case 'b': baseline = optarg; break;
+      case 'u': update = true; break;
+      case 't': dir = optarg; break;
+      default:
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  char spec[128];
+  synth_opt_t sopt;
+  snprintf(spec, sizeof(spec), "%s,%zu,1e-6,1e3,1,0.02", shape, num_samples);
+  if ((num_samples == 0) || !synth_parse_opt(&sopt, spec)) {
+    print_help();
+    exit(EXIT_FAILURE);
+  }
+  char *buf = synth_famos(&sopt, &b.count);
+  if (buf == NULL) {
+    printf("bench: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  char file[256];
+  snprintf(file, sizeof(file), "%s/dso_bench.dat", dir);
+  FILE *fd = fopen(file, "w");
+  if ((fd == NULL) || (fwrite(buf, 1, b.count, fd) != b.count) || (fclose(fd) != 0)) {
+    printf("cannot write %s\n", file);
+    exit(EXIT_FAILURE);
+  }
+  char out_file[256];
+  snprintf(out_file, sizeof(out_file), "%s/dso_bench_save.dat", dir);
+  b.file = file;
+  b.out_file = out_file;
+  b.buf = buf;
+  famos_parse(buf, b.count, &b.trace);
+  b.num_samples = b.trace.num_samples;
+
+  printf("Benchmark on %zu samples (%s, %zu bytes)\n", b.num_samples, shape, b.count);
+  bench_result_t r[4];
+  r[0] = run_stage(&b, "parse", stage_parse);
+  r[1] = run_stage(&b, "convert", stage_convert);
+  r[2] = run_stage(&b, "csv", stage_csv);
+  r[3] = run_stage(&b, "convert_and_save", stage_save);
+
+  bool regression = false;
+  printf("%-16s %12s %12s %12s %10s\n", "stage", "time [ms]", "ns/sample", "MB/s", "baseline");
+  for (size_t i = 0; i < 4; i++) {
+    const double base = update ? 0.0 : baseline_value(baseline, r[i].name);
+    char cmp[32] = "-";
+    if (base > 0.0) {
+      const double change = r[i].ns_per_sample/base - 1.0;
+      snprintf(cmp, sizeof(cmp), "%+.1f%%%s", 100.0*change, (change > BENCH_TOLERANCE) ? " !" : "");
+      regression |= (change > BENCH_TOLERANCE);
+    }
+    printf("%-16s %12.3f %12.3f %12.1f %10s\n", r[i].name, 1e3*r[i].seconds,
+           r[i].ns_per_sample, r[i].mb_per_s, cmp);
+  }
+
+  char csvfile[256];
+  famos_exchange_ext(csvfile, sizeof(csvfile), file, ".csv");
+  remove(csvfile);
+  remove(file);
+  famos_exchange_ext(csvfile, sizeof(csvfile), out_file, ".csv");
+  remove(csvfile);
+  remove(out_file);
+  free(buf);
+
+  if (update || (baseline_value(baseline, "parse") == 0.0)) {
+    if (!save_baseline(baseline, r, 4, b.num_samples)) {
+      printf("cannot write %s\n", baseline);
+      exit(EXIT_FAILURE);
+    }
+    printf("Baseline written to %s%s\n", baseline,
+           update ? "" : " (none found), later runs are compared with it");
+  } else if (regression) {
+    printf("Stages marked with ! are more than %.0f%% slower than %s\n", 100.0*BENCH_TOLERANCE, baseline);
+    exit(EXIT_FAILURE);
+  }
+  return EXIT_SUCCESS;
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
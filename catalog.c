@@ -0,0 +1,557 @@
+/** \file catalog.c
+ * \brief Indexed metadata catalogue of converted track files
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup catalog Track file catalogue
+ *
+ * The catalogue file consists of a header, the fixed size records in
+ * insertion order and for every key of #catalog_key_t a permutation of
+ * the record numbers sorted by that key. A query picks the filter with
+ * the narrowest range in its index (two binary searches) and checks the
+ * remaining filters on the records within that range only. New records
+ * are inserted into the indexes by binary search, so converting a file
+ * never touches the other track files of the archive.
+ *
+ * @{
+ */
+
+#define _GNU_SOURCE /* strptime(), timegm() */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "catalog.h"
+
+
+/** Magic of the catalogue file format (including the format version) */
+static const char catalog_magic[8] = "DSOCAT1";
+
+
+/** On disk header of a catalogue file */
+typedef struct {
+  char magic[8];
+  uint32_t entry_size;
+  uint32_t num_keys;
+  uint64_t count;
+} catalog_header_t;
+
+
+/** Query operators */
+typedef enum { OP_EQ, OP_LT, OP_LE, OP_GT, OP_GE } catalog_op_t;
+
+
+/** A parsed query filter.
+ *
+ * lo and hi are probe records which carry the filter value in the field
+ * of the key. They only differ for dates given without time (hi is the
+ * last second of the day).
+ */
+typedef struct {
+  catalog_key_t key;
+  catalog_op_t op;
+  bool pattern;
+  const char *value;
+  catalog_entry_t lo;
+  catalog_entry_t hi;
+} catalog_filter_t;
+
+
+static const char *key_names[CATALOG_NUM_KEYS] = {
+  "rate", "delay", "timebase", "mesial", "offset",
+  "date", "samples", "dso", "path", "hash"
+};
+
+
+static int cmp_double(const double a, const double b)
+{
+  return (a < b) ? -1 : (a > b);
+}
+
+
+static int cmp_int64(const int64_t a, const int64_t b)
+{
+  return (a < b) ? -1 : (a > b);
+}
+
+
+/** Order of two records with respect to key */
+static int cmp_key(const catalog_key_t key, const catalog_entry_t *a, const catalog_entry_t *b)
+{
+  switch (key) {
+    case CATALOG_KEY_RATE:     return cmp_double(a->sample_rate, b->sample_rate);
+    case CATALOG_KEY_DELAY:    return cmp_double(a->trigger_delay, b->trigger_delay);
+    case CATALOG_KEY_TIMEBASE: return cmp_int64(a->timebase, b->timebase);
+    case CATALOG_KEY_MESIAL:   return cmp_double(a->mesial_voltage, b->mesial_voltage);
+    case CATALOG_KEY_OFFSET:   return cmp_double(a->offset_voltage, b->offset_voltage);
+    case CATALOG_KEY_DATE:     return cmp_int64(a->datetime, b->datetime);
+    case CATALOG_KEY_SAMPLES:  return cmp_int64(a->num_samples, b->num_samples);
+    case CATALOG_KEY_DSO:      return strcmp(a->dso_type, b->dso_type);
+    case CATALOG_KEY_PATH:     return strcmp(a->path, b->path);
+    case CATALOG_KEY_HASH:     return (a->hash < b->hash) ? -1 : (a->hash > b->hash);
+    default:                   return 0;
+  }
+}
+
+
+/** First position in the index of key whose record is not less than probe */
+static size_t lower_bound(const catalog_t *cat, const catalog_key_t key, const catalog_entry_t *probe)
+{
+  size_t lo = 0, hi = cat->count;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo)/2;
+    if (cmp_key(key, &cat->entries[cat->index[key][mid]], probe) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+
+/** First position in the index of key whose record is greater than probe */
+static size_t upper_bound(const catalog_t *cat, const catalog_key_t key, const catalog_entry_t *probe)
+{
+  size_t lo = 0, hi = cat->count;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo)/2;
+    if (cmp_key(key, &cat->entries[cat->index[key][mid]], probe) <= 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+
+/** Convert the NT date and time strings into seconds since 1970.
+ *
+ * The DSO firmware versions differ in the date notation, hence the
+ * common ones are tried one after the other.
+ *
+ * \return false if the date is not recognised
+ */
+static bool parse_datetime(const char *date, const char *time, int64_t *datetime, bool *has_time)
+{
+  static const char *date_formats[] = {
+    "%Y-%m-%d", "%d-%b-%Y", "%d-%m-%Y", "%d.%m.%Y", "%d/%m/%Y", "%d %b %Y", NULL
+  };
+  struct tm tm;
+  const char *rest = NULL;
+
+  *datetime = 0;
+  *has_time = false;
+  for (size_t i = 0; (date_formats[i] != NULL) && (rest == NULL); i++) {
+    memset(&tm, 0, sizeof(tm));
+    rest = strptime(date, date_formats[i], &tm);
+    /* a format only matches if it takes the whole date, "01-06-2017"
+     * would otherwise be read as year 1 by "%Y-%m-%d" */
+    if ((rest != NULL) && (*rest != '\0') && (*rest != ' ') && (*rest != 'T')) {
+      rest = NULL;
+    }
+  }
+  if (rest == NULL) {
+    return false;
+  }
+  /* date and time may also be given in one string */
+  while (*rest == ' ' || *rest == 'T') {
+    rest++;
+  }
+  if (*rest == '\0') {
+    rest = time;
+  }
+  if ((rest != NULL) && (*rest != '\0')) {
+    if ((strptime(rest, "%H:%M:%S", &tm) != NULL) || (strptime(rest, "%H:%M", &tm) != NULL)) {
+      *has_time = true;
+    }
+  }
+  *datetime = (int64_t)timegm(&tm);
+  return true;
+}
+
+
+/** FNV-1a hash of a memory block */
+static uint64_t fnv1a(const void *buf, const size_t count)
+{
+  const uint8_t *b = (const uint8_t *)buf;
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < count; i++) {
+    h ^= b[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+
+/* documented in catalog.h */
+void catalog_entry_init(catalog_entry_t *entry, const famos_trace_t *trace,
+                        const char *path, const void *buf, const size_t count)
+{
+  bool has_time;
+
+  memset(entry, 0, sizeof(*entry));
+  entry->sample_rate = trace->sample_rate;
+  entry->trigger_delay = trace->trigger_delay;
+  entry->mesial_voltage = trace->mesial_voltage;
+  entry->offset_voltage = trace->offset_voltage;
+  entry->timebase = trace->timebase;
+  entry->num_samples = (uint32_t)trace->num_samples;
+  snprintf(entry->date, sizeof(entry->date), "%s", trace->date);
+  snprintf(entry->time, sizeof(entry->time), "%s", trace->time);
+  snprintf(entry->dso_type, sizeof(entry->dso_type), "%s", trace->dso_type);
+  /* an unknown date is stored as 0 */
+  parse_datetime(trace->date, trace->time, &entry->datetime, &has_time);
+  entry->hash = fnv1a(buf, count);
+  /* store the absolute path if there is one */
+  char *real = realpath(path, NULL);
+  snprintf(entry->path, sizeof(entry->path), "%s", (real != NULL) ? real : path);
+  free(real);
+}
+
+
+/** Make room for at least n records */
+static void catalog_reserve(catalog_t *cat, const size_t n)
+{
+  if (n <= cat->capacity) {
+    return;
+  }
+  size_t capacity = (cat->capacity > 0) ? cat->capacity : 64;
+  while (capacity < n) {
+    capacity *= 2;
+  }
+  cat->entries = realloc(cat->entries, capacity*sizeof(catalog_entry_t));
+  if (cat->entries == NULL) {
+    printf("catalogue: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t k = 0; k < CATALOG_NUM_KEYS; k++) {
+    cat->index[k] = realloc(cat->index[k], capacity*sizeof(uint32_t));
+    if (cat->index[k] == NULL) {
+      printf("catalogue: out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  cat->capacity = capacity;
+}
+
+
+/* documented in catalog.h */
+bool catalog_load(catalog_t *cat, const char *file)
+{
+  catalog_header_t header;
+
+  memset(cat, 0, sizeof(*cat));
+  FILE *fd = fopen(file, "r");
+  if (fd == NULL) {
+    return true;
+  }
+  bool ok = (fread(&header, sizeof(header), 1, fd) == 1) &&
+            (memcmp(header.magic, catalog_magic, sizeof(catalog_magic)) == 0) &&
+            (header.entry_size == sizeof(catalog_entry_t)) &&
+            (header.num_keys == CATALOG_NUM_KEYS) &&
+            (header.count < UINT32_MAX);
+  if (ok) {
+    catalog_reserve(cat, (size_t)header.count);
+    cat->count = (size_t)header.count;
+    ok = (fread(cat->entries, sizeof(catalog_entry_t), cat->count, fd) == cat->count);
+    for (size_t k = 0; ok && (k < CATALOG_NUM_KEYS); k++) {
+      ok = (fread(cat->index[k], sizeof(uint32_t), cat->count, fd) == cat->count);
+    }
+  }
+  fclose(fd);
+  if (!ok) {
+    printf("%s is not a valid track file catalogue\n", file);
+    catalog_free(cat);
+  }
+  return ok;
+}
+
+
+/* documented in catalog.h */
+bool catalog_save(const catalog_t *cat, const char *file)
+{
+  catalog_header_t header;
+  const size_t tmplen = strlen(file) + sizeof(".tmp");
+  char *tmpfile = malloc(tmplen);
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, catalog_magic, sizeof(catalog_magic));
+  header.entry_size = sizeof(catalog_entry_t);
+  header.num_keys = CATALOG_NUM_KEYS;
+  header.count = cat->count;
+
+  if (tmpfile == NULL) {
+    printf("catalogue: out of memory\n");
+    return false;
+  }
+  snprintf(tmpfile, tmplen, "%s.tmp", file);
+  FILE *fd = fopen(tmpfile, "w");
+  if (fd == NULL) {
+    printf("cannot write catalogue %s\n", tmpfile);
+    free(tmpfile);
+    return false;
+  }
+  bool ok = (fwrite(&header, sizeof(header), 1, fd) == 1) &&
+            (fwrite(cat->entries, sizeof(catalog_entry_t), cat->count, fd) == cat->count);
+  for (size_t k = 0; ok && (k < CATALOG_NUM_KEYS); k++) {
+    ok = (fwrite(cat->index[k], sizeof(uint32_t), cat->count, fd) == cat->count);
+  }
+  ok = (fclose(fd) == 0) && ok;
+  if (ok) {
+    ok = (rename(tmpfile, file) == 0);
+  }
+  if (!ok) {
+    printf("cannot write catalogue %s\n", file);
+    remove(tmpfile);
+  }
+  free(tmpfile);
+  return ok;
+}
+
+
+/* documented in catalog.h */
+void catalog_free(catalog_t *cat)
+{
+  free(cat->entries);
+  for (size_t k = 0; k < CATALOG_NUM_KEYS; k++) {
+    free(cat->index[k]);
+  }
+  memset(cat, 0, sizeof(*cat));
+}
+
+
+/** Remove record number n from the index of key */
+static void index_remove(catalog_t *cat, const catalog_key_t key, const uint32_t n)
+{
+  uint32_t *idx = cat->index[key];
+  /* narrow the search by the key value, then look for the record number */
+  size_t pos = lower_bound(cat, key, &cat->entries[n]);
+  while ((pos < cat->count) && (idx[pos] != n)) {
+    pos++;
+  }
+  if (pos < cat->count) {
+    memmove(&idx[pos], &idx[pos + 1], (cat->count - pos - 1)*sizeof(uint32_t));
+  }
+}
+
+
+/** Insert record number n into the index of key (index holds count-1 entries) */
+static void index_insert(catalog_t *cat, const catalog_key_t key, const uint32_t n)
+{
+  uint32_t *idx = cat->index[key];
+  /* binary search on the first count-1 positions */
+  cat->count--;
+  const size_t pos = upper_bound(cat, key, &cat->entries[n]);
+  cat->count++;
+  memmove(&idx[pos + 1], &idx[pos], (cat->count - 1 - pos)*sizeof(uint32_t));
+  idx[pos] = n;
+}
+
+
+/* documented in catalog.h */
+void catalog_add(catalog_t *cat, const catalog_entry_t *entry)
+{
+  /* a track file which is converted again replaces its old record */
+  const size_t pos = lower_bound(cat, CATALOG_KEY_PATH, entry);
+  if ((pos < cat->count) &&
+      (strcmp(cat->entries[cat->index[CATALOG_KEY_PATH][pos]].path, entry->path) == 0)) {
+    const uint32_t n = cat->index[CATALOG_KEY_PATH][pos];
+    for (size_t k = 0; k < CATALOG_NUM_KEYS; k++) {
+      index_remove(cat, (catalog_key_t)k, n);
+    }
+    cat->entries[n] = *entry;
+    for (size_t k = 0; k < CATALOG_NUM_KEYS; k++) {
+      index_insert(cat, (catalog_key_t)k, n);
+    }
+    return;
+  }
+
+  catalog_reserve(cat, cat->count + 1);
+  const uint32_t n = (uint32_t)cat->count;
+  cat->entries[n] = *entry;
+  cat->count++;
+  for (size_t k = 0; k < CATALOG_NUM_KEYS; k++) {
+    index_insert(cat, (catalog_key_t)k, n);
+  }
+}
+
+
+/** Parse "key<op>value" into a filter, returns false if malformed */
+static bool parse_filter(const char *expr, catalog_filter_t *f)
+{
+  memset(f, 0, sizeof(*f));
+  const size_t keylen = strcspn(expr, "<>=");
+  if (expr[keylen] == '\0') {
+    return false;
+  }
+  size_t k;
+  for (k = 0; k < CATALOG_NUM_KEYS; k++) {
+    if ((strlen(key_names[k]) == keylen) && (strncmp(expr, key_names[k], keylen) == 0)) {
+      break;
+    }
+  }
+  if (k == CATALOG_NUM_KEYS) {
+    return false;
+  }
+  f->key = (catalog_key_t)k;
+
+  const char *op = expr + keylen;
+  if (strncmp(op, "<=", 2) == 0) {
+    f->op = OP_LE; f->value = op + 2;
+  } else if (strncmp(op, ">=", 2) == 0) {
+    f->op = OP_GE; f->value = op + 2;
+  } else if (op[0] == '<') {
+    f->op = OP_LT; f->value = op + 1;
+  } else if (op[0] == '>') {
+    f->op = OP_GT; f->value = op + 1;
+  } else {
+    f->op = OP_EQ; f->value = op + 1;
+  }
+
+  char *end = NULL;
+  catalog_entry_t *e = &f->lo;
+  switch (f->key) {
+    case CATALOG_KEY_RATE:     e->sample_rate = strtod(f->value, &end); break;
+    case CATALOG_KEY_DELAY:    e->trigger_delay = strtod(f->value, &end); break;
+    case CATALOG_KEY_TIMEBASE: e->timebase = (int32_t)strtol(f->value, &end, 10); break;
+    case CATALOG_KEY_MESIAL:   e->mesial_voltage = strtod(f->value, &end); break;
+    case CATALOG_KEY_OFFSET:   e->offset_voltage = strtod(f->value, &end); break;
+    case CATALOG_KEY_SAMPLES:  e->num_samples = (uint32_t)strtoul(f->value, &end, 10); break;
+    case CATALOG_KEY_HASH:     e->hash = strtoull(f->value, &end, 16); break;
+    case CATALOG_KEY_DSO:
+      snprintf(e->dso_type, sizeof(e->dso_type), "%s", f->value);
+      break;
+    case CATALOG_KEY_PATH:
+      snprintf(e->path, sizeof(e->path), "%s", f->value);
+      f->pattern = (strpbrk(f->value, "*?[") != NULL);
+      if (f->pattern && (f->op != OP_EQ)) {
+        return false;
+      }
+      break;
+    case CATALOG_KEY_DATE: {
+      bool has_time;
+      if (!parse_datetime(f->value, NULL, &e->datetime, &has_time)) {
+        return false;
+      }
+      f->hi = f->lo;
+      if (!has_time) {
+        f->hi.datetime += 24*3600 - 1;
+      }
+      return true;
+    }
+    default:
+      return false;
+  }
+  f->hi = f->lo;
+  return (end == NULL) || ((end != f->value) && (*end == '\0'));
+}
+
+
+/** Index range [*first, *last) of the records which satisfy filter f */
+static void filter_range(const catalog_t *cat, const catalog_filter_t *f, size_t *first, size_t *last)
+{
+  *first = 0;
+  *last = cat->count;
+  if (f->pattern) {
+    return;
+  }
+  switch (f->op) {
+    case OP_EQ: *first = lower_bound(cat, f->key, &f->lo); *last = upper_bound(cat, f->key, &f->hi); break;
+    case OP_LT: *last = lower_bound(cat, f->key, &f->lo); break;
+    case OP_LE: *last = upper_bound(cat, f->key, &f->hi); break;
+    case OP_GT: *first = upper_bound(cat, f->key, &f->hi); break;
+    case OP_GE: *first = lower_bound(cat, f->key, &f->lo); break;
+  }
+}
+
+
+/** Check a single record against filter f */
+static bool filter_match(const catalog_filter_t *f, const catalog_entry_t *e)
+{
+  if (f->pattern) {
+    return (fnmatch(f->value, e->path, 0) == 0);
+  }
+  switch (f->op) {
+    case OP_EQ: return (cmp_key(f->key, e, &f->lo) >= 0) && (cmp_key(f->key, e, &f->hi) <= 0);
+    case OP_LT: return (cmp_key(f->key, e, &f->lo) < 0);
+    case OP_LE: return (cmp_key(f->key, e, &f->hi) <= 0);
+    case OP_GT: return (cmp_key(f->key, e, &f->hi) > 0);
+    case OP_GE: return (cmp_key(f->key, e, &f->lo) >= 0);
+  }
+  return false;
+}
+
+
+/* documented in catalog.h */
+long catalog_query(const catalog_t *cat, char * const *filters, const size_t num_filters)
+{
+  catalog_filter_t f[num_filters > 0 ? num_filters : 1];
+  size_t best = 0, first = 0, last = cat->count;
+  catalog_key_t key = CATALOG_KEY_DATE;
+
+  for (size_t i = 0; i < num_filters; i++) {
+    if (!parse_filter(filters[i], &f[i])) {
+      printf("malformed catalogue filter: \"%s\"\n", filters[i]);
+      return -1;
+    }
+    size_t a, b;
+    filter_range(cat, &f[i], &a, &b);
+    if ((i == 0) || (b - a < last - first)) {
+      best = i;
+      first = a;
+      last = b;
+      key = f[i].key;
+    }
+  }
+
+  long hits = 0;
+  printf("#path\tdate\ttime\tdso\tsamplerate\ttrigger delay\tmesial\toffset\tsamples\thash\n");
+  for (size_t pos = first; pos < last; pos++) {
+    const catalog_entry_t *e = &cat->entries[cat->index[key][pos]];
+    bool match = true;
+    for (size_t i = 0; match && (i < num_filters); i++) {
+      if (i != best || f[i].pattern) {
+        match = filter_match(&f[i], e);
+      }
+    }
+    if (match) {
+      printf("%s\t%s\t%s\t%s\t%.7e\t%.7e\t%.7e\t%.7e\t%" PRIu32 "\t%016" PRIx64 "\n",
+             e->path, e->date, e->time, e->dso_type, e->sample_rate, e->trigger_delay,
+             e->mesial_voltage, e->offset_voltage, e->num_samples, e->hash);
+      hits++;
+    }
+  }
+  return hits;
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
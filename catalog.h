@@ -0,0 +1,147 @@
+/** \file catalog.h
+ * \brief Indexed metadata catalogue of converted track files
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup catalog
+ * @{
+ */
+
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "famos.h"
+
+
+/** Maximum length of a path stored in the catalogue (including '\0') */
+#define CATALOG_PATH_LEN 256
+
+
+/** Fixed size catalogue record of one converted track file.
+ *
+ * Records are stored in host byte order, the catalogue is meant to
+ * live next to the archive on the machine which does the conversion.
+ */
+typedef struct {
+  double sample_rate;
+  double trigger_delay;
+  double mesial_voltage;
+  double offset_voltage;
+  /** NT date and time in seconds since 1970 (scope local time), 0 if unknown */
+  int64_t datetime;
+  /** FNV-1a hash over the raw track file */
+  uint64_t hash;
+  uint32_t num_samples;
+  int32_t timebase;
+  char date[32];
+  char time[32];
+  char dso_type[32];
+  char path[CATALOG_PATH_LEN];
+} catalog_entry_t;
+
+
+/** Keys the catalogue keeps a sorted index for */
+typedef enum {
+  CATALOG_KEY_RATE,
+  CATALOG_KEY_DELAY,
+  CATALOG_KEY_TIMEBASE,
+  CATALOG_KEY_MESIAL,
+  CATALOG_KEY_OFFSET,
+  CATALOG_KEY_DATE,
+  CATALOG_KEY_SAMPLES,
+  CATALOG_KEY_DSO,
+  CATALOG_KEY_PATH,
+  CATALOG_KEY_HASH,
+  CATALOG_NUM_KEYS
+} catalog_key_t;
+
+
+/** In memory image of a catalogue file */
+typedef struct {
+  catalog_entry_t *entries;
+  size_t count;
+  size_t capacity;
+  /** per key: entry numbers sorted by that key */
+  uint32_t *index[CATALOG_NUM_KEYS];
+} catalog_t;
+
+
+/** Load a catalogue, a missing file yields an empty catalogue.
+ *
+ * \return false if the file exists but is not a valid catalogue
+ */
+bool catalog_load(catalog_t *cat, const char *file);
+
+
+/** Write the catalogue (via a temporary file which is renamed) */
+bool catalog_save(const catalog_t *cat, const char *file);
+
+
+/** Release the memory of a catalogue */
+void catalog_free(catalog_t *cat);
+
+
+/** Fill a catalogue record from a decoded track file.
+ *
+ * \param entry record to be filled
+ * \param trace decoded track file
+ * \param path location of the raw track file
+ * \param buf raw track file content (hashed)
+ * \param count number of bytes in buf
+ */
+void catalog_entry_init(catalog_entry_t *entry, const famos_trace_t *trace,
+                        const char *path, const void *buf, const size_t count);
+
+
+/** Insert a record and update all indexes incrementally.
+ *
+ * A record with the same path replaces the existing one.
+ */
+void catalog_add(catalog_t *cat, const catalog_entry_t *entry);
+
+
+/** Run a query and print the matching records to stdout.
+ *
+ * \param cat catalogue
+ * \param filters array of expressions "key=value", "key<value",
+ *        "key<=value", "key>value" or "key>=value".
+ *        Keys: rate, delay, timebase, mesial, offset, date, samples,
+ *        dso, path, hash. A path value containing '*' or '?' is
+ *        matched as shell pattern, dates are given as YYYY-MM-DD or
+ *        "YYYY-MM-DD HH:MM:SS".
+ * \param num_filters number of filters (all of them have to match)
+ * \return number of matching records or -1 on a malformed filter
+ */
+long catalog_query(const catalog_t *cat, char * const *filters, const size_t num_filters);
+
+
+/** @} */
+
+#endif /* !CATALOG_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,142 @@
+/** \file convert.c
+ * \brief Conversion of received or stored track files
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup convert Track file conversion
+ *
+ * A track file is parsed once and fed to the selected output sinks, the
+ * running average and the limit test in a single pass. The conversion
+ * is shared by the downloads, the offline conversion and the benchmark.
+ *
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "convert.h"
+
+
+/* documented in convert.h */
+void catalog_disc(const char *file, const void *buf, const size_t count,
+                  const famos_trace_t *trace, convopt_t *convopt)
+{
+  if ((convopt->catalog_file != NULL) && (trace->samples != NULL)) {
+    catalog_entry_t entry;
+    catalog_entry_init(&entry, trace, file, buf, count);
+    catalog_add(&convopt->catalog, &entry);
+    printf("Catalogued: %s\n", entry.path);
+  }
+}
+
+
+/* documented in convert.h */
+void convert_disc(const char *file, const void *buf, const size_t count,
+                  const sink_opt_t *outputs, convopt_t *convopt)
+{
+  famos_trace_t trace;
+  sink_t sinks[SINK_MAX];
+
+  famos_parse(buf, count, &trace);
+  if (trace.has_xaxis) {
+    printf("Samplerate: %e\n", trace.sample_rate);
+    printf("Trigger Delay: %e\n", trace.trigger_delay);
+  } else {
+    printf("Note: No horizontal setup found\n");
+  }
+  if (trace.has_yaxis) {
+    printf("Mesial Voltage: %e\n", trace.mesial_voltage);
+    printf("Offset Voltage: %e\n", trace.offset_voltage);
+  } else {
+    printf("Note: No vertical setup found\n");
+  }
+  if (trace.samples == NULL) {
+    printf("Note: no datapoints found\n");
+  }
+
+  sink_source_t src;
+  memset(&src, 0, sizeof(src));
+  src.file = file;
+  src.raw = buf;
+  src.raw_count = count;
+  src.trace = &trace;
+  src.num_samples = trace.num_samples;
+  size_t num_sinks = sink_select(sinks, outputs);
+  if (convopt->average_file != NULL) {
+    average_sink(&sinks[num_sinks++], &convopt->average);
+  }
+  if (convopt->limit.n > 0) {
+    limit_sink(&sinks[num_sinks++], &convopt->limit);
+  }
+  if (!sink_run(sinks, num_sinks, &src)) {
+    exit(EXIT_FAILURE);
+  }
+
+  catalog_disc(file, buf, count, &trace, convopt);
+}
+
+
+/* documented in convert.h */
+void convert_and_save_disc(const char *file, const void *buf, const size_t count, convopt_t *convopt)
+{
+  if (file == NULL) {
+    printf("no output file specified - storing under default './log.*'\n");
+    file = "log.dat";
+  }
+  /* the raw track file is one of the outputs of the conversion pass */
+  sink_opt_t outputs = convopt->outputs;
+  outputs.raw = true;
+  convert_disc(file, buf, count, &outputs, convopt);
+}
+
+
+/* documented in convert.h */
+void finish_conversions(convopt_t *convopt)
+{
+  if ((convopt->catalog_file != NULL) && !catalog_save(&convopt->catalog, convopt->catalog_file)) {
+    exit(EXIT_FAILURE);
+  }
+  if ((convopt->average_file != NULL) && (convopt->average.count > 0)) {
+    /* sized from the state file name, a long path must not be cut off */
+    const size_t size = strlen(convopt->average_file) + sizeof(".csv");
+    char *fileexp = malloc(size);
+    if (fileexp == NULL) {
+      printf("Out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+    famos_exchange_ext(fileexp, size, convopt->average_file, ".csv");
+    if (!average_save(&convopt->average, convopt->average_file) ||
+        !average_write_csv(&convopt->average, fileexp)) {
+      exit(EXIT_FAILURE);
+    }
+    free(fileexp);
+  }
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,85 @@
+/** \file convert.h
+ * \brief Conversion of received or stored track files interface
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup convert
+ * @{
+ */
+
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "famos.h"
+#include "sink.h"
+#include "catalog.h"
+#include "average.h"
+#include "limit.h"
+
+
+/** Outputs and shared state of the conversions of one session */
+typedef struct {
+  /** catalogue of the converted traces, NULL if not kept */
+  char *catalog_file;
+  catalog_t catalog;
+  sink_opt_t outputs;
+  /** running average, NULL if not kept */
+  char *average_file;
+  average_t average;
+  /** limit masks, the test runs if limit.n > 0 */
+  char *limit_file;
+  limit_t limit;
+} convopt_t;
+
+
+/** Record a converted track file in the catalogue */
+void catalog_disc(const char *file, const void *buf, const size_t count,
+                  const famos_trace_t *trace, convopt_t *convopt);
+
+
+/** Convert the FAMOS track file in buf (stored as file) into the
+ *  selected outputs in one pass and register it in the catalogue.
+ *
+ * The average and the limit test of convopt are fed by the same pass.
+ */
+void convert_disc(const char *file, const void *buf, const size_t count,
+                  const sink_opt_t *outputs, convopt_t *convopt);
+
+
+/** Store a received track file under file (log.dat if NULL) and convert it */
+void convert_and_save_disc(const char *file, const void *buf, const size_t count, convopt_t *convopt);
+
+
+/** Store the catalogue and the running average after the conversions */
+void finish_conversions(convopt_t *convopt);
+
+
+/** @} */
+
+#endif /* !CONVERT_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
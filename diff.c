@@ -0,0 +1,144 @@
+/** \file diff.c
+ * \brief Time aligned difference of two traces (background subtraction)
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup diff Trace difference
+ *
+ * Both traces are aligned on their real time axes t = i*samplerate -
+ * triggerdelay. If they share the sample grid the difference is a plain
+ * shifted vector operation, otherwise B is linearly interpolated at the
+ * sample times of A. The kernels work on whole blocks without branches
+ * so the compiler vectorises them.
+ *
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "diff.h"
+
+
+/** Tolerance in samples when comparing positions on the sample grid */
+#define GRID_EPS 1e-6
+
+
+/* documented in diff.h */
+bool diff_init(diff_t *d, const trace_data_t *a, const trace_data_t *b, const double scale)
+{
+  const famos_trace_t *ha = &a->header, *hb = &b->header;
+
+  memset(d, 0, sizeof(*d));
+  d->a = a;
+  d->b = b;
+  d->scale = scale;
+
+  /* fractional b index of a sample i of A: start + i*step */
+  d->step = ha->sample_rate/hb->sample_rate;
+  d->start = trace_index(hb, -ha->trigger_delay);
+
+  /* samples of A within [0, nb-1] on the axis of B */
+  const double lo = ceil((0.0 - d->start)/d->step - GRID_EPS);
+  const double hi = floor(((double)(b->n - 1) - d->start)/d->step + GRID_EPS);
+  const double first = (lo > 0.0) ? lo : 0.0;
+  const double last = (hi < (double)(a->n - 1)) ? hi : (double)(a->n - 1);
+  if (last < first) {
+    return false;
+  }
+  d->first = (size_t)first;
+  d->n = (size_t)(last - first) + 1;
+
+  const double shift = round(d->start);
+  if ((fabs(d->step - 1.0) < 1e-9) && (fabs(d->start - shift) < GRID_EPS)) {
+    d->same_grid = true;
+    d->shift = (long)shift;
+  }
+
+  d->header = *ha;
+  d->header.samples = NULL;
+  d->header.num_samples = d->n;
+  d->header.trigger_delay = ha->trigger_delay - (double)d->first*ha->sample_rate;
+  /* the volts/div of A do not describe the difference */
+  d->header.has_yaxis = false;
+  return true;
+}
+
+
+/** out = a - k*b */
+static void diff_kernel(const double * restrict a, const double * restrict b, const double k,
+                        double * restrict out, const size_t n)
+{
+  for (size_t i = 0; i < n; i++) {
+    out[i] = a[i] - k*b[i];
+  }
+}
+
+
+/** out = a - k*(b[j] + f*(b[j+1]-b[j])) with j, f the integer and fractional part of pos */
+static void diff_kernel_interp(const double * restrict a, const double * restrict b,
+                               const double k, const double pos0, const double step,
+                               const size_t nb, double * restrict out, const size_t n)
+{
+  for (size_t i = 0; i < n; i++) {
+    double pos = pos0 + (double)i*step;
+    /* clamp the rounding noise at both ends of B */
+    pos = (pos < 0.0) ? 0.0 : pos;
+    pos = (pos > (double)(nb - 1)) ? (double)(nb - 1) : pos;
+    size_t j = (size_t)pos;
+    j = (j + 1 < nb) ? j : nb - 2;
+    const double f = pos - (double)j;
+    out[i] = a[i] - k*(b[j] + f*(b[j + 1] - b[j]));
+  }
+}
+
+
+/* documented in diff.h */
+void diff_fetch(const sink_source_t *src, const size_t first, const size_t n,
+                double *t, double *v)
+{
+  const diff_t *d = src->ctx;
+  const size_t i0 = d->first + first;
+
+  for (size_t i = 0; i < n; i++) {
+    t[i] = famos_time(&d->header, first + i);
+  }
+  if (d->same_grid) {
+    diff_kernel(d->a->v + i0, d->b->v + (long)i0 + d->shift, d->scale, v, n);
+  } else if (d->b->n < 2) {
+    for (size_t i = 0; i < n; i++) {
+      v[i] = d->a->v[i0 + i] - d->scale*d->b->v[0];
+    }
+  } else {
+    diff_kernel_interp(d->a->v + i0, d->b->v, d->scale, d->start + (double)i0*d->step,
+                       d->step, d->b->n, v, n);
+  }
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,78 @@
+/** \file diff.h
+ * \brief Time aligned difference of two traces (background subtraction) interface
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup diff
+ * @{
+ */
+
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "famos.h"
+#include "trace.h"
+#include "sink.h"
+
+
+/** Difference A - scale*B on the time axis of A */
+typedef struct {
+  const trace_data_t *a;
+  const trace_data_t *b;
+  double scale;
+  /** header of the result (time axis of A restricted to the overlap) */
+  famos_trace_t header;
+  /** first sample of A inside the time span of B */
+  size_t first;
+  /** number of samples of the result */
+  size_t n;
+  /** both traces share the sample grid: b index = a index + shift */
+  bool same_grid;
+  long shift;
+  /** otherwise: fractional b index = start + i*step for a index i */
+  double start;
+  double step;
+} diff_t;
+
+
+/** Align trace b to the time axis of trace a.
+ *
+ * \return false if the time spans of both traces do not overlap
+ */
+bool diff_init(diff_t *d, const trace_data_t *a, const trace_data_t *b, const double scale);
+
+
+/** Sink fetch function computing the result (src->ctx is the #diff_t) */
+void diff_fetch(const sink_source_t *src, const size_t first, const size_t n,
+                double *t, double *v);
+
+
+/** @} */
+
+#endif /* !DIFF_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
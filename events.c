@@ -0,0 +1,419 @@
+/** \file events.c
+ * \brief Software trigger and event search on the 8 bit sample codes
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup events Software trigger and event search
+ *
+ * The thresholds are converted into codes once, the search then never
+ * decodes a sample. Between two events the scanner only has to find the
+ * next code outside of a band, which is done 16 (SSE2) or 32 (AVX2)
+ * codes at a time; the hysteresis state machine runs once per event.
+ *
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "events.h"
+
+
+/** Scanner states */
+enum {
+  STATE_INIT,
+  STATE_LOW,
+  STATE_RUNT,
+  STATE_HIGH
+};
+
+
+/** Rise of a pulse which started before the trace */
+#define RISE_UNKNOWN UINT64_MAX
+
+
+static const char * const event_names[] = {
+  "rise", "fall", "narrow", "wide", "runt", "range"
+};
+
+
+/** Parse a floating point number which has to fill the whole string */
+static bool parse_double(const char *str, double *value)
+{
+  char *end;
+  *value = strtod(str, &end);
+  return (end != str) && (*end == '\0');
+}
+
+
+/* documented in events.h */
+bool events_parse_opt(events_opt_t *opt, const char *str)
+{
+  char item[64];
+  events_opt_t o;
+
+  /* the options are only changed if the whole string is valid */
+  memset(&o, 0, sizeof(o));
+  while (*str != '\0') {
+    const size_t len = strcspn(str, ",");
+    if ((len == 0) || (len >= sizeof(item))) {
+      return false;
+    }
+    memcpy(item, str, len);
+    item[len] = '\0';
+    str += len;
+    if (*str == ',') {
+      str++;
+    }
+    bool ok;
+    if (strncmp(item, "level=", 6) == 0) {
+      ok = parse_double(item + 6, &o.level);
+    } else if (strncmp(item, "hyst=", 5) == 0) {
+      ok = parse_double(item + 5, &o.hyst) && (o.hyst >= 0.0);
+    } else if (strncmp(item, "min=", 4) == 0) {
+      ok = parse_double(item + 4, &o.min_width) && (o.min_width >= 0.0);
+    } else if (strncmp(item, "max=", 4) == 0) {
+      ok = parse_double(item + 4, &o.max_width) && (o.max_width >= 0.0);
+    } else if (strncmp(item, "runt=", 5) == 0) {
+      ok = parse_double(item + 5, &o.runt);
+      o.has_runt = true;
+    } else {
+      ok = (strcmp(item, "range") == 0);
+      o.range = ok;
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  *opt = o;
+  return true;
+}
+
+
+/* documented in events.h */
+size_t events_find_outside(const uint8_t *c, const size_t n, const int lo, const int hi)
+{
+  size_t i = 0;
+
+  if ((lo < 0) && (hi > 255)) {
+    return n;
+  }
+  const int l = (lo > 255) ? 255 : lo;
+  const int h = (hi < 0) ? 0 : hi;
+  /* unsigned compares by min/max: c <= lo <=> min(c, lo) == c */
+#ifdef __AVX2__
+  {
+    const __m256i vlo = _mm256_set1_epi8((char)(l < 0 ? 0 : l));
+    const __m256i vhi = _mm256_set1_epi8((char)(h > 255 ? 255 : h));
+    const __m256i elo = _mm256_set1_epi8((char)(l < 0 ? 0 : -1));
+    const __m256i ehi = _mm256_set1_epi8((char)(h > 255 ? 0 : -1));
+    for (; i + 32 <= n; i += 32) {
+      const __m256i x = _mm256_loadu_si256((const __m256i *)(c + i));
+      const __m256i mlo = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(x, vlo), x), elo);
+      const __m256i mhi = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(x, vhi), x), ehi);
+      const unsigned int m = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(mlo, mhi));
+      if (m != 0) {
+        return i + (size_t)__builtin_ctz(m);
+      }
+    }
+  }
+#endif
+#ifdef __SSE2__
+  {
+    const __m128i vlo = _mm_set1_epi8((char)(l < 0 ? 0 : l));
+    const __m128i vhi = _mm_set1_epi8((char)(h > 255 ? 255 : h));
+    const __m128i elo = _mm_set1_epi8((char)(l < 0 ? 0 : -1));
+    const __m128i ehi = _mm_set1_epi8((char)(h > 255 ? 0 : -1));
+    for (; i + 16 <= n; i += 16) {
+      const __m128i x = _mm_loadu_si128((const __m128i *)(c + i));
+      const __m128i mlo = _mm_and_si128(_mm_cmpeq_epi8(_mm_min_epu8(x, vlo), x), elo);
+      const __m128i mhi = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(x, vhi), x), ehi);
+      const unsigned int m = (unsigned int)_mm_movemask_epi8(_mm_or_si128(mlo, mhi));
+      if (m != 0) {
+        return i + (size_t)__builtin_ctz(m);
+      }
+    }
+  }
+#endif
+  for (; i < n; i++) {
+    if (((int)c[i] <= l) || ((int)c[i] >= h)) {
+      return i;
+    }
+  }
+  return n;
+}
+
+
+/** Fractional code of voltage v */
+static double voltage_code(const famos_trace_t *h, const double v)
+{
+  return 128.0 + 128.0*(v + h->offset_voltage)/h->mesial_voltage;
+}
+
+
+/** Clamp a threshold code, 256 means never reached */
+static int clamp_code(const double code)
+{
+  if (code < 0.0) {
+    return 0;
+  }
+  return (code > 256.0) ? 256 : (int)code;
+}
+
+
+/* documented in events.h */
+void events_init(events_t *ev, const events_opt_t *opt, const famos_trace_t *header)
+{
+  memset(ev, 0, sizeof(*ev));
+  ev->opt = *opt;
+  ev->header = *header;
+  ev->header.samples = NULL;
+  ev->state = STATE_INIT;
+  ev->rise = RISE_UNKNOWN;
+
+  /* a falling mesial voltage would swap high and low, the scope never
+   * writes one hence the thresholds are taken as they are */
+  const double mesial = (header->mesial_voltage != 0.0) ? header->mesial_voltage : 1.0;
+  ev->header.mesial_voltage = mesial;
+  ev->level_code = voltage_code(&ev->header, opt->level);
+  ev->hi = clamp_code(ceil(voltage_code(&ev->header, opt->level + 0.5*opt->hyst)));
+  ev->lo = clamp_code(floor(voltage_code(&ev->header, opt->level - 0.5*opt->hyst)));
+  if (ev->lo >= ev->hi) {
+    ev->lo = ev->hi - 1;
+  }
+  ev->runt_hi = clamp_code(ceil(voltage_code(&ev->header, opt->runt + 0.5*opt->hyst)));
+  ev->runt_lo = clamp_code(floor(voltage_code(&ev->header, opt->runt - 0.5*opt->hyst)));
+  if (ev->runt_lo >= ev->runt_hi) {
+    ev->runt_lo = ev->runt_hi - 1;
+  }
+  if (ev->runt_hi >= ev->hi) {
+    ev->opt.has_runt = false;
+  }
+}
+
+
+static void add_event(events_t *ev, const uint64_t index, const double time,
+                      const event_type_t type, const uint64_t width)
+{
+  if (ev->count == ev->capacity) {
+    ev->capacity = (ev->capacity > 0) ? 2*ev->capacity : 256;
+    event_t *e = realloc(ev->events, ev->capacity*sizeof(event_t));
+    if (e == NULL) {
+      printf("events: out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+    ev->events = e;
+  }
+  event_t *e = &ev->events[ev->count++];
+  e->index = index;
+  e->time = time;
+  e->type = (uint32_t)type;
+  e->width = (width > UINT32_MAX) ? UINT32_MAX : (uint32_t)width;
+}
+
+
+/** Time where the codes a (at sample i-1) and b (at sample i) cross the level */
+static double edge_time(const events_t *ev, const uint64_t i, const uint8_t a, const uint8_t b)
+{
+  double frac = 1.0;
+  if ((i > 0) && (a != b)) {
+    frac = (ev->level_code - (double)a)/((double)b - (double)a);
+    frac = (frac < 0.0) ? 0.0 : ((frac > 1.0) ? 1.0 : frac);
+  }
+  return famos_time(&ev->header, (size_t)i) - (1.0 - frac)*ev->header.sample_rate;
+}
+
+
+/** Report the pulse width of a pulse which ended at sample fall */
+static void check_width(events_t *ev, const uint64_t fall)
+{
+  if (ev->rise == RISE_UNKNOWN) {
+    return;
+  }
+  const uint64_t width = fall - ev->rise;
+  const double seconds = (double)width*ev->header.sample_rate;
+  const double t = famos_time(&ev->header, (size_t)ev->rise);
+  if ((ev->opt.min_width > 0.0) && (seconds < ev->opt.min_width)) {
+    add_event(ev, ev->rise, t, EVENT_NARROW, width);
+  }
+  if ((ev->opt.max_width > 0.0) && (seconds > ev->opt.max_width)) {
+    add_event(ev, ev->rise, t, EVENT_WIDE, width);
+  }
+}
+
+
+/** Edge, pulse and runt search of one block */
+static void scan_edges(events_t *ev, const uint8_t *c, const uint64_t first, const size_t n)
+{
+  size_t pos = 0;
+
+  if (ev->state == STATE_INIT) {
+    ev->state = (c[0] >= ev->hi) ? STATE_HIGH : STATE_LOW;
+  }
+  while (pos < n) {
+    size_t i;
+    if (ev->state == STATE_LOW) {
+      i = pos + events_find_outside(c + pos, n - pos, -1, ev->opt.has_runt ? ev->runt_hi : ev->hi);
+    } else if (ev->state == STATE_RUNT) {
+      i = pos + events_find_outside(c + pos, n - pos, ev->runt_lo, ev->hi);
+    } else {
+      i = pos + events_find_outside(c + pos, n - pos, ev->lo, 256);
+    }
+    if (i >= n) {
+      break;
+    }
+    const uint64_t abs = first + i;
+    const uint8_t prev = (i > 0) ? c[i - 1] : ev->prev;
+    if (ev->state == STATE_HIGH) {
+      add_event(ev, abs, edge_time(ev, abs, prev, c[i]), EVENT_FALL, 0);
+      check_width(ev, abs);
+      ev->state = STATE_LOW;
+    } else if (c[i] >= ev->hi) {
+      add_event(ev, abs, edge_time(ev, abs, prev, c[i]), EVENT_RISE, 0);
+      ev->rise = abs;
+      ev->state = STATE_HIGH;
+    } else if (ev->state == STATE_LOW) {
+      ev->runt_start = abs;
+      ev->state = STATE_RUNT;
+    } else {
+      add_event(ev, ev->runt_start, famos_time(&ev->header, (size_t)ev->runt_start),
+                EVENT_RUNT, abs - ev->runt_start);
+      ev->state = STATE_LOW;
+    }
+    pos = i + 1;
+  }
+}
+
+
+/** Search of runs of out of range (0x00) codes in one block */
+static void scan_range(events_t *ev, const uint8_t *c, const uint64_t first, const size_t n)
+{
+  size_t pos = 0;
+  while (pos < n) {
+    if (ev->in_range_run) {
+      const size_t i = pos + events_find_outside(c + pos, n - pos, -1, 1);
+      if (i >= n) {
+        break;
+      }
+      add_event(ev, ev->range_start, famos_time(&ev->header, (size_t)ev->range_start),
+                EVENT_RANGE, first + i - ev->range_start);
+      ev->in_range_run = false;
+      pos = i + 1;
+    } else {
+      const size_t i = pos + events_find_outside(c + pos, n - pos, 0, 256);
+      if (i >= n) {
+        break;
+      }
+      ev->range_start = first + i;
+      ev->in_range_run = true;
+      pos = i + 1;
+    }
+  }
+}
+
+
+/* documented in events.h */
+void events_scan(events_t *ev, const uint8_t *codes, const uint64_t first, const size_t n)
+{
+  if (n == 0) {
+    return;
+  }
+  scan_edges(ev, codes, first, n);
+  if (ev->opt.range) {
+    scan_range(ev, codes, first, n);
+  }
+  ev->prev = codes[n - 1];
+  ev->next = first + n;
+}
+
+
+/** Order of the event index: by sample number, edges before pulse checks */
+static int compare_events(const void *a, const void *b)
+{
+  const event_t *ea = a, *eb = b;
+  if (ea->index != eb->index) {
+    return (ea->index < eb->index) ? -1 : 1;
+  }
+  return (ea->type > eb->type) - (ea->type < eb->type);
+}
+
+
+/* documented in events.h */
+void events_finish(events_t *ev)
+{
+  if (ev->in_range_run) {
+    add_event(ev, ev->range_start, famos_time(&ev->header, (size_t)ev->range_start),
+              EVENT_RANGE, ev->next - ev->range_start);
+    ev->in_range_run = false;
+  }
+  /* pulse checks and out of range runs are reported at their end */
+  qsort(ev->events, ev->count, sizeof(event_t), compare_events);
+}
+
+
+/* documented in events.h */
+bool events_save(const events_t *ev, const char *csvfile, const char *idxfile)
+{
+  FILE *fd = fopen(csvfile, "w");
+  if (fd == NULL) {
+    return false;
+  }
+  famos_write_csv_header(fd, &ev->header);
+  fprintf(fd, "#Event level [V]:   \t%.7e\n", ev->opt.level);
+  fprintf(fd, "#Event hysteresis:  \t%.7e\n", ev->opt.hyst);
+  fprintf(fd, "#Number of Events:  \t%zu\n", ev->count);
+  fprintf(fd, "#Time [s] \t Event \t Sample \t Width [s]\n");
+  for (size_t i = 0; i < ev->count; i++) {
+    const event_t *e = &ev->events[i];
+    fprintf(fd, "%.7e \t %s \t %llu \t %.7e\n", e->time, event_names[e->type],
+            (unsigned long long)e->index, (double)e->width*ev->header.sample_rate);
+  }
+  bool ok = (fclose(fd) == 0);
+
+  fd = fopen(idxfile, "wb");
+  if (fd == NULL) {
+    return false;
+  }
+  const size_t written = fwrite(ev->events, sizeof(event_t), ev->count, fd);
+  ok = (fclose(fd) == 0) && (written == ev->count) && ok;
+  return ok;
+}
+
+
+/* documented in events.h */
+void events_free(events_t *ev)
+{
+  free(ev->events);
+  memset(ev, 0, sizeof(*ev));
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,145 @@
+/** \file events.h
+ * \brief Software trigger and event search on the 8 bit sample codes interface
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup events
+ * @{
+ */
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "famos.h"
+
+
+/** Event search settings (voltages in volts, widths in seconds) */
+typedef struct {
+  /** edge threshold */
+  double level;
+  /** hysteresis around level (and runt) */
+  double hyst;
+  /** report positive pulses narrower than min_width (0: off) */
+  double min_width;
+  /** report positive pulses wider than max_width (0: off) */
+  double max_width;
+  /** report pulses which cross runt but not level */
+  bool has_runt;
+  double runt;
+  /** report runs of out of range (0x00) samples */
+  bool range;
+} events_opt_t;
+
+
+/** Event types */
+typedef enum {
+  EVENT_RISE,
+  EVENT_FALL,
+  EVENT_NARROW,
+  EVENT_WIDE,
+  EVENT_RUNT,
+  EVENT_RANGE
+} event_type_t;
+
+
+/** One entry of the event index (the record of the *_events.idx file) */
+typedef struct {
+  /** sample number where the event starts */
+  uint64_t index;
+  /** time of the event (edges are interpolated between two samples) */
+  double time;
+  /** #event_type_t */
+  uint32_t type;
+  /** duration in samples (pulses, runts, out of range runs) */
+  uint32_t width;
+} event_t;
+
+
+/** Scanner state, the trace may be fed in blocks */
+typedef struct {
+  events_opt_t opt;
+  famos_trace_t header;
+  /** thresholds in codes: high if >= hi, low if <= lo */
+  int hi, lo;
+  int runt_hi, runt_lo;
+  /** level in (fractional) codes for the edge interpolation */
+  double level_code;
+  int state;
+  uint64_t rise;
+  uint64_t runt_start;
+  bool in_range_run;
+  uint64_t range_start;
+  /** last code of the previous block */
+  uint8_t prev;
+  uint64_t next;
+  event_t *events;
+  size_t count;
+  size_t capacity;
+} events_t;
+
+
+/** Parse "level=V,hyst=V,min=T,max=T,runt=V,range" (all entries optional) */
+bool events_parse_opt(events_opt_t *opt, const char *str);
+
+
+/** Position of the first code <= lo or >= hi.
+ *
+ * Compares 16 (SSE2) or 32 (AVX2) codes at once. A side is disabled by
+ * lo < 0 respectively hi > 255.
+ *
+ * \return index of the first match or n if there is none
+ */
+size_t events_find_outside(const uint8_t *c, const size_t n, const int lo, const int hi);
+
+
+/** Prepare a scan of a trace with the given header */
+void events_init(events_t *ev, const events_opt_t *opt, const famos_trace_t *header);
+
+
+/** Scan the next n codes, first is the sample number of codes[0] */
+void events_scan(events_t *ev, const uint8_t *codes, const uint64_t first, const size_t n);
+
+
+/** Close runs which last until the end of the trace */
+void events_finish(events_t *ev);
+
+
+/** Write the event list as CSV and the event index as array of #event_t */
+bool events_save(const events_t *ev, const char *csvfile, const char *idxfile);
+
+
+/** Release the memory of a scan */
+void events_free(events_t *ev);
+
+
+/** @} */
+
+#endif /* !EVENTS_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
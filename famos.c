@@ -0,0 +1,261 @@
+/** \file famos.c
+ * \brief FAMOS track file (.DAT) decoder
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup famos FAMOS track file decoder
+ * @{
+ */
+
+#define _GNU_SOURCE /* memmem() */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <regex.h>
+
+#include "famos.h"
+
+
+/** Header records are plain text and are located in front of the CS record */
+#define MAX_HEADER_SIZE 4096
+
+
+/** Copy match n of str into dst (null terminated, truncated to size) */
+static void copy_match(char *dst, const size_t size, const char *str, const regmatch_t *match)
+{
+  size_t len = match->rm_eo - match->rm_so;
+  if (len >= size) {
+    len = size - 1;
+  }
+  memcpy(dst, str + match->rm_so, len);
+  dst[len] = '\0';
+}
+
+
+/** Run regex pattern on the null terminated header, returns true on match */
+static bool match_header(const char *header, const char *pattern,
+                         const size_t nmatch, regmatch_t *match)
+{
+  regex_t reg;
+  if (regcomp(&reg, pattern, REG_EXTENDED) != 0) {
+    return false;
+  }
+  const int r = regexec(&reg, header, nmatch, match, 0);
+  regfree(&reg);
+  return (r == 0);
+}
+
+
+/* documented in famos.h */
+bool famos_parse(const void *buf, const size_t count, famos_trace_t *trace)
+{
+  const char *data = (const char *)buf;
+  char header[MAX_HEADER_SIZE];
+  char str[64];
+  regmatch_t match[5];
+
+  memset(trace, 0, sizeof(*trace));
+  trace->sample_rate = 1.0;
+  trace->timebase = -1;
+  trace->variable_volts = -1;
+
+  /* the sample data may contain any byte including 0x00 (out of range)
+   * hence only the text in front of the CS record is handed to regexec */
+  const char *cs = memmem(data, count, "|CS,1,", 6);
+  size_t header_len = (cs != NULL) ? (size_t)(cs - data) : count;
+  if (header_len >= sizeof(header)) {
+    header_len = sizeof(header) - 1;
+  }
+  memcpy(header, data, header_len);
+  header[header_len] = '\0';
+
+  /*
+  |CD,1,a,1,b,c,d,e;
+    X-axis:
+    a=sample rate (default 1. for ext clock)
+    b=trigger delay
+    c=0 for ext clock,1 for DSO timebase
+    d=length of e string (1 or 6)
+    e=EXTCLK or s (s=seconds)
+
+    we search for one or more character not containing ',' which are separated by ','
+  */
+  if (match_header(header, "\\|CD,1,([^,]+),1,([^,]+),([^,]+),[^,]+,[^,]+;", 4, match)) {
+    trace->has_xaxis = true;
+    copy_match(str, sizeof(str), header, &match[1]);
+    trace->sample_rate = strtod(str, NULL);
+    copy_match(str, sizeof(str), header, &match[2]);
+    trace->trigger_delay = strtod(str, NULL);
+    const char ch = header[match[3].rm_so];
+    if (ch == '0') {
+      trace->timebase = 0;
+    } else if (ch == '1') {
+      trace->timebase = 1;
+    }
+  }
+
+  /*
+  |CR,1,1,0,1,0.,255.,0.,255.,a,b,c,d,e;
+    Y-axis:
+    a=mesial voltage
+    b=offset in volts
+    c=1 if variable volts/div off, else 0
+    d=length of e string (1 or 4)
+    e=V if variable volts/div off, else V NC
+  */
+  if (match_header(header, "\\|CR,1,1,0,1,[^,]+,[^,]+,[^,]+,[^,]+,([^,]+),([^,]+),([^,]+),[^,]+,[^,]+;",
+                   4, match)) {
+    trace->has_yaxis = true;
+    copy_match(str, sizeof(str), header, &match[1]);
+    trace->mesial_voltage = strtod(str, NULL);
+    copy_match(str, sizeof(str), header, &match[2]);
+    trace->offset_voltage = strtod(str, NULL);
+    const char ch = header[match[3].rm_so];
+    if (ch == '0') {
+      trace->variable_volts = 0;
+    } else if (ch == '1') {
+      trace->variable_volts = 1;
+    }
+  }
+
+  /*
+  |NT,1,a,b,c,d;
+    b=date and year
+    d=time
+  */
+  if (match_header(header, "\\|NT,1,[^,]+,([^,]+),[^,]+,([^,]+);", 3, match)) {
+    copy_match(trace->date, sizeof(trace->date), header, &match[1]);
+    copy_match(trace->time, sizeof(trace->time), header, &match[2]);
+  }
+
+  /*
+  |NL,1,a;
+    a=DSO type
+  */
+  if (match_header(header, "\\|NL,1,([^,]+);", 2, match)) {
+    copy_match(trace->dso_type, sizeof(trace->dso_type), header, &match[1]);
+  }
+
+  /*
+  |CS,1,a,b;
+    a=the number of data bytes
+    b=the data itself
+  |CA,1,0000000000;
+    Footer
+  */
+  if (cs == NULL) {
+    return false;
+  }
+  const char *p = cs + 6;
+  const char *end = data + count;
+  size_t declared = 0;
+  while ((p < end) && (*p >= '0') && (*p <= '9')) {
+    declared = 10*declared + (size_t)(*p - '0');
+    p++;
+  }
+  if ((p >= end) || (*p != ',')) {
+    return false;
+  }
+  p++;
+  /* the data runs up to the (last) footer, same as the greedy
+   * "(.*);\|CA,1,0000000000;" pattern used by dat2csv.pl */
+  const char footer[] = ";|CA,1,";
+  const char *q = NULL;
+  for (size_t n = (size_t)(end - p); n >= sizeof(footer) - 1; n--) {
+    if (memcmp(p + n - (sizeof(footer) - 1), footer, sizeof(footer) - 1) == 0) {
+      q = p + n - (sizeof(footer) - 1);
+      break;
+    }
+  }
+  if (q == NULL) {
+    /* truncated transfer - take what was declared and is available */
+    q = p + declared;
+    if (q > end) {
+      q = end;
+    }
+  }
+  trace->samples = (const uint8_t *)p;
+  trace->num_samples = (size_t)(q - p);
+  return true;
+}
+
+
+/* documented in famos.h */
+void famos_write_csv_header(FILE *fd, const famos_trace_t *trace)
+{
+  if (trace->has_xaxis) {
+    fprintf(fd, "#X-Axis:\n");
+    fprintf(fd, "#Samplerate:        \t%.7e\n", trace->sample_rate);
+    fprintf(fd, "#Trigger delay:     \t%.7e\n", trace->trigger_delay);
+    if (trace->timebase == 0) {
+      fprintf(fd, "#Time base:       \tExt clock\n");
+    } else if (trace->timebase == 1) {
+      fprintf(fd, "#Time base:        \tDSO timebase\n");
+    } else {
+      fprintf(fd, "#Error: unknown timebase field\n");
+    }
+  }
+  if (trace->has_yaxis) {
+    fprintf(fd, "#Y-Axis:\n");
+    fprintf(fd, "#Mesial voltage:    \t%.7e\n", trace->mesial_voltage);
+    fprintf(fd, "#Offset in volts:   \t%.7e\n", trace->offset_voltage);
+    if (trace->variable_volts == 0) {
+      fprintf(fd, "#Variable volts/div on\n");
+    } else if (trace->variable_volts == 1) {
+      fprintf(fd, "#Variable volts/div off\n");
+    } else {
+      fprintf(fd, "#Error: variable volts/div\n");
+    }
+  }
+  if (trace->date[0] != '\0') {
+    fprintf(fd, "#Date an year:      \t%s\n", trace->date);
+    fprintf(fd, "#Time:              \t%s\n", trace->time);
+  }
+  if (trace->dso_type[0] != '\0') {
+    fprintf(fd, "#DSO type:          \t%s\n", trace->dso_type);
+  }
+  if ((trace->samples != NULL) || (trace->num_samples > 0)) {
+    fprintf(fd, "#Number of Samples: \t%zu\n", trace->num_samples);
+  }
+}
+
+
+/* documented in famos.h */
+void famos_exchange_ext(char *dst, const size_t size, const char *file, const char *ext)
+{
+  snprintf(dst, size, "%s", file);
+  char *pExt = strrchr(dst, '.');
+  char *pSep = strrchr(dst, '/');
+  if ((pExt != NULL) && ((pSep == NULL) || (pExt > pSep))) {
+    *pExt = '\0';
+  }
+  const size_t len = strlen(dst);
+  snprintf(dst + len, size - len, "%s", ext);
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,132 @@
+/** \file famos.h
+ * \brief FAMOS track file (.DAT) decoder interface
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup famos
+ * @{
+ */
+
+#ifndef FAMOS_H
+#define FAMOS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+/** Largest track file the converter reads in bytes */
+#define FAMOS_MAX_FILE_SIZE (1024*1024)
+
+
+/** Decoded content of a FAMOS track file as written by the DSO.
+ *
+ * The sample pointer refers into the buffer handed to famos_parse(),
+ * hence the buffer has to outlive the trace.
+ */
+typedef struct {
+  /** CD record found */
+  bool has_xaxis;
+  /** time between two samples in seconds (CD field a) */
+  double sample_rate;
+  /** trigger point in seconds with respect to start of data */
+  double trigger_delay;
+  /** 0 for ext clock, 1 for DSO timebase, -1 unknown */
+  int timebase;
+  /** CR record found */
+  bool has_yaxis;
+  /** +-maximum voltage on the screen regardless offset */
+  double mesial_voltage;
+  /** channel position in physical units */
+  double offset_voltage;
+  /** 0 variable volts/div on, 1 off, -1 unknown */
+  int variable_volts;
+  /** NT record: date and year as written by the DSO, empty if missing */
+  char date[32];
+  /** NT record: time as written by the DSO, empty if missing */
+  char time[32];
+  /** NL record: DSO type, empty if missing */
+  char dso_type[32];
+  /** CS record: raw 8 bit sample codes */
+  const uint8_t *samples;
+  /** number of samples, 0 if no CS record was found */
+  size_t num_samples;
+} famos_trace_t;
+
+
+/** Decode the records of a FAMOS track file.
+ *
+ * \param buf raw file content (need not be null terminated)
+ * \param count number of bytes in buf
+ * \param trace decoded header fields and a pointer to the samples
+ * \return true if a CS data record was found
+ */
+bool famos_parse(const void *buf, const size_t count, famos_trace_t *trace);
+
+
+/** Physical voltage of an 8 bit sample code.
+ *
+ * range in data file 0x00 .. 0xff:
+ * 0xff correlates with y-max display position on the scope screen,
+ * 0x01 with y-min, 0x80 is the "zero line" on the graticule and
+ * 0x00 can occur in file but is not visible on the display ("out of range")
+ */
+static inline double famos_voltage(const famos_trace_t *trace, const uint8_t code)
+{
+  /* could be either
+     physVoltage=mesialVoltage*(internalVoltage-128.0l)/128.0l-offsetVoltage;
+     or
+     physVoltage=mesialVoltage*(internalVoltage-128.0l)/127.0l-offsetVoltage;
+   */
+  return trace->mesial_voltage*((double)(code)-128.0)/128.0-trace->offset_voltage;
+}
+
+
+/** Time of sample i with respect to the trigger point */
+static inline double famos_time(const famos_trace_t *trace, const size_t i)
+{
+  return (double)(i)*trace->sample_rate-trace->trigger_delay;
+}
+
+
+/** Write the "#" comment header of a CSV export (the same as dat2csv.pl) */
+void famos_write_csv_header(FILE *fd, const famos_trace_t *trace);
+
+
+/** Replace the file extension of file by ext (e.g. ".csv") or append it.
+ *
+ * \param dst destination buffer
+ * \param size size of dst
+ * \param file original file name
+ * \param ext new extension including the dot
+ */
+void famos_exchange_ext(char *dst, const size_t size, const char *file, const char *ext);
+
+
+/** @} */
+
+#endif /* !FAMOS_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
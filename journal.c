@@ -0,0 +1,252 @@
+/** \file journal.c
+ * \brief Binary journal of a serial session and its replay
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup journal Session journal
+ *
+ * The file starts with #JOURNAL_MAGIC followed by records, each a
+ * #journal_record_t header and its bytes. The replay hands the received
+ * bytes back to the receive loops in the chunks they were read, either
+ * at the recorded pace (relative to the preceding command) or at once.
+ *
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+
+#define JOURNAL_MAGIC "DSOJNL1\n"
+
+/** Size of the append buffer */
+#define JOURNAL_BUF (64*1024)
+
+
+static uint64_t monotonic_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+/** write() everything or report */
+static bool write_all(const int fd, const void *data, size_t length)
+{
+  const char *p = data;
+  while (length > 0) {
+    const ssize_t n = write(fd, p, length);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    length -= (size_t)n;
+  }
+  return true;
+}
+
+
+static void journal_flush(journal_t *j)
+{
+  if ((j->fill > 0) && !write_all(j->fd, j->buf, j->fill)) {
+    printf("journal: write error\n");
+  }
+  j->fill = 0;
+}
+
+
+/* documented in journal.h */
+bool journal_open(journal_t *j, const char *file)
+{
+  memset(j, 0, sizeof(*j));
+  j->fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  j->buf = malloc(JOURNAL_BUF);
+  if ((j->fd < 0) || (j->buf == NULL)) {
+    printf("cannot write %s\n", file);
+    if (j->fd >= 0) {
+      close(j->fd);
+    }
+    free(j->buf);
+    memset(j, 0, sizeof(*j));
+    j->fd = -1;
+    return false;
+  }
+  j->start_ns = monotonic_ns();
+  memcpy(j->buf, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC) - 1);
+  j->fill = sizeof(JOURNAL_MAGIC) - 1;
+  return true;
+}
+
+
+/* documented in journal.h */
+void journal_record(journal_t *j, const journal_type_t type, const void *data, const size_t length)
+{
+  journal_record_t rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.time_ns = monotonic_ns() - j->start_ns;
+  rec.type = (uint32_t)type;
+  rec.length = (uint32_t)length;
+
+  if (j->fill + sizeof(rec) > JOURNAL_BUF) {
+    journal_flush(j);
+  }
+  memcpy(j->buf + j->fill, &rec, sizeof(rec));
+  j->fill += sizeof(rec);
+  if (j->fill + length > JOURNAL_BUF) {
+    journal_flush(j);
+    if (length >= JOURNAL_BUF) {
+      if (!write_all(j->fd, data, length)) {
+        printf("journal: write error\n");
+      }
+      return;
+    }
+  }
+  memcpy(j->buf + j->fill, data, length);
+  j->fill += length;
+}
+
+
+/* documented in journal.h */
+bool journal_close(journal_t *j)
+{
+  journal_flush(j);
+  const bool ok = (close(j->fd) == 0);
+  free(j->buf);
+  memset(j, 0, sizeof(*j));
+  return ok;
+}
+
+
+/* documented in journal.h */
+bool journal_load(journal_t *j, const char *file, const bool max_speed)
+{
+  memset(j, 0, sizeof(*j));
+  j->max_speed = max_speed;
+  FILE *fd = fopen(file, "r");
+  if (fd == NULL) {
+    printf("cannot open %s\n", file);
+    return false;
+  }
+  fseek(fd, 0, SEEK_END);
+  const long size = ftell(fd);
+  rewind(fd);
+  j->data = (size > 0) ? malloc((size_t)size) : NULL;
+  j->size = (j->data != NULL) ? fread(j->data, 1, (size_t)size, fd) : 0;
+  fclose(fd);
+  if ((j->size < sizeof(JOURNAL_MAGIC) - 1) ||
+      (memcmp(j->data, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC) - 1) != 0)) {
+    printf("%s: no session journal\n", file);
+    journal_free(j);
+    return false;
+  }
+  j->pos = sizeof(JOURNAL_MAGIC) - 1;
+  j->offset_ns = (int64_t)monotonic_ns();
+  return true;
+}
+
+
+/** Header of the record at the read position, false at the end of the journal */
+static bool next_record(const journal_t *j, journal_record_t *rec)
+{
+  if (j->pos + sizeof(*rec) > j->size) {
+    return false;
+  }
+  memcpy(rec, j->data + j->pos, sizeof(*rec));
+  return (j->pos + sizeof(*rec) + rec->length <= j->size);
+}
+
+
+/* documented in journal.h */
+void journal_expect(journal_t *j, const void *cmd, const size_t length)
+{
+  journal_record_t rec;
+
+  /* bytes nobody asked for are dropped, as the DSO would not repeat them */
+  while (next_record(j, &rec) && (rec.type != JOURNAL_TX)) {
+    j->pos += sizeof(rec) + rec.length;
+  }
+  j->done = 0;
+  if (!next_record(j, &rec)) {
+    printf("Replay: command %.*s not in the journal\n", (int)length, (const char *)cmd);
+    return;
+  }
+  const char *recorded = j->data + j->pos + sizeof(rec);
+  if ((rec.length != length) || (memcmp(recorded, cmd, length) != 0)) {
+    printf("Replay: journal has %.*s instead of %.*s\n", (int)rec.length, recorded,
+           (int)length, (const char *)cmd);
+  }
+  j->offset_ns = (int64_t)monotonic_ns() - (int64_t)rec.time_ns;
+  j->pos += sizeof(rec) + rec.length;
+}
+
+
+/* documented in journal.h */
+ssize_t journal_read(journal_t *j, void *buf, const size_t size)
+{
+  journal_record_t rec;
+  size_t n = 0;
+
+  while ((n < size) && next_record(j, &rec) && (rec.type == JOURNAL_RX)) {
+    if (!j->max_speed && ((int64_t)monotonic_ns() < j->offset_ns + (int64_t)rec.time_ns)) {
+      break;
+    }
+    size_t len = rec.length - j->done;
+    len = (len < size - n) ? len : size - n;
+    memcpy((char *)buf + n, j->data + j->pos + sizeof(rec) + j->done, len);
+    n += len;
+    j->done += len;
+    if (j->done == rec.length) {
+      j->pos += sizeof(rec) + rec.length;
+      j->done = 0;
+    }
+    if (!j->max_speed) {
+      /* one read() per recorded chunk */
+      break;
+    }
+  }
+  if ((n == 0) && j->max_speed) {
+    return -1;
+  }
+  return (ssize_t)n;
+}
+
+
+/* documented in journal.h */
+void journal_free(journal_t *j)
+{
+  free(j->data);
+  memset(j, 0, sizeof(*j));
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
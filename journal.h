@@ -0,0 +1,119 @@
+/** \file journal.h
+ * \brief Binary journal of a serial session and its replay interface
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup journal
+ * @{
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+
+/** Record types */
+typedef enum {
+  /** command sent to the DSO */
+  JOURNAL_TX = 1,
+  /** bytes returned by one read() of the serial link */
+  JOURNAL_RX = 2
+} journal_type_t;
+
+
+/** Record header in the file, followed by length bytes */
+typedef struct {
+  /** CLOCK_MONOTONIC nanoseconds since the start of the session */
+  uint64_t time_ns;
+  uint32_t type;
+  uint32_t length;
+} journal_record_t;
+
+
+/** A journal being written or replayed */
+typedef struct {
+  /* ---- recording ---- */
+  int fd;
+  char *buf;
+  size_t fill;
+  uint64_t start_ns;
+  /* ---- replay ---- */
+  char *data;
+  size_t size;
+  /** read position (start of the next record) */
+  size_t pos;
+  /** bytes of the current RX record already handed out */
+  size_t done;
+  /** deliver the records without waiting */
+  bool max_speed;
+  /** replay clock minus recorded clock, resynchronised at every command */
+  int64_t offset_ns;
+} journal_t;
+
+
+/** Create a journal file, every record is appended through a buffer */
+bool journal_open(journal_t *j, const char *file);
+
+
+/** Append a record stamped with the current time */
+void journal_record(journal_t *j, const journal_type_t type, const void *data, const size_t length);
+
+
+/** Flush and close a journal file */
+bool journal_close(journal_t *j);
+
+
+/** Load a journal for replay.
+ *
+ * \param max_speed hand out the received bytes without the recorded delays
+ */
+bool journal_load(journal_t *j, const char *file, const bool max_speed);
+
+
+/** Replay of send_cmd(): skip to the recorded command, warn if it differs */
+void journal_expect(journal_t *j, const void *cmd, const size_t length);
+
+
+/** Replay of read() on the serial link.
+ *
+ * Returns the received bytes which are due by now, 0 if there are none
+ * yet and -1 at maximum speed if the response is complete (the next
+ * record is a command or the journal ends).
+ */
+ssize_t journal_read(journal_t *j, void *buf, const size_t size);
+
+
+/** Release a replayed journal */
+void journal_free(journal_t *j);
+
+
+/** @} */
+
+#endif /* !JOURNAL_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,382 @@
+/** \file limit.c
+ * \brief Limit mask pass/fail test of captured traces
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup limit Limit mask test
+ *
+ * The masks are compared with the 8 bit codes of a trace, the sink is
+ * codes_only so a pass which only feeds it decodes no sample. A trace
+ * whose length or time base differs from the masks is logged as SKIP
+ * and counted as failed. If the trace was captured with another volts/div than the
+ * masks, the masks are translated into the codes of the trace once per
+ * trace (upper rounded down, lower rounded up).
+ *
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "limit.h"
+
+
+static uint8_t *copy_codes(const famos_trace_t *trace)
+{
+  uint8_t *c = malloc(trace->num_samples);
+  if (c != NULL) {
+    memcpy(c, trace->samples, trace->num_samples);
+  }
+  return c;
+}
+
+
+/* documented in limit.h */
+bool limit_init(limit_t *lim, const void *upper, const size_t upper_count,
+                const void *lower, const size_t lower_count)
+{
+  famos_trace_t up, low;
+
+  memset(lim, 0, sizeof(*lim));
+  if (!famos_parse(upper, upper_count, &up) || (up.num_samples == 0)) {
+    printf("upper limit mask: no samples found\n");
+    return false;
+  }
+  if (!famos_parse(lower, lower_count, &low) || (low.num_samples == 0)) {
+    printf("lower limit mask: no samples found\n");
+    return false;
+  }
+  if ((up.num_samples != low.num_samples) || (up.mesial_voltage != low.mesial_voltage) ||
+      (up.offset_voltage != low.offset_voltage)) {
+    printf("upper and lower limit mask differ in length or setup\n");
+    return false;
+  }
+  lim->header = up;
+  lim->header.samples = NULL;
+  lim->n = up.num_samples;
+  lim->upper = copy_codes(&up);
+  lim->lower = copy_codes(&low);
+  if ((lim->upper == NULL) || (lim->lower == NULL)) {
+    printf("limit: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return true;
+}
+
+
+/* documented in limit.h */
+void limit_cache_files(const char *base, char *upper, char *lower, const size_t size)
+{
+  famos_exchange_ext(upper, size, base, "_upper.dat");
+  famos_exchange_ext(lower, size, base, "_lower.dat");
+}
+
+
+/** Read a whole file, NULL if it does not exist */
+static char *read_file(const char *file, size_t *count)
+{
+  FILE *fd = fopen(file, "r");
+  if (fd == NULL) {
+    return NULL;
+  }
+  fseek(fd, 0, SEEK_END);
+  const long size = ftell(fd);
+  rewind(fd);
+  char *buf = (size > 0) ? malloc((size_t)size) : NULL;
+  *count = (buf != NULL) ? fread(buf, 1, (size_t)size, fd) : 0;
+  fclose(fd);
+  return buf;
+}
+
+
+/* documented in limit.h */
+bool limit_load(limit_t *lim, const char *base)
+{
+  char upper_file[256], lower_file[256];
+  size_t upper_count = 0, lower_count = 0;
+
+  memset(lim, 0, sizeof(*lim));
+  limit_cache_files(base, upper_file, lower_file, sizeof(upper_file));
+  char *upper = read_file(upper_file, &upper_count);
+  char *lower = read_file(lower_file, &lower_count);
+  const bool ok = (upper != NULL) && (lower != NULL) &&
+                  limit_init(lim, upper, upper_count, lower, lower_count);
+  free(upper);
+  free(lower);
+  return ok;
+}
+
+
+/* documented in limit.h */
+void limit_free(limit_t *lim)
+{
+  free(lim->upper);
+  free(lim->lower);
+  free(lim->upper_trace);
+  free(lim->lower_trace);
+  free(lim->forced);
+  memset(lim, 0, sizeof(*lim));
+}
+
+
+/* documented in limit.h */
+void limit_compare(const uint8_t *codes, const uint8_t *upper, const uint8_t *lower,
+                   const size_t n, size_t *first_fail, size_t *above, size_t *below)
+{
+  size_t i = 0, up = 0, low = 0;
+
+  *first_fail = n;
+  /* c > u <=> max(c, u) != u and c < l <=> min(c, l) != l */
+#ifdef __AVX2__
+  for (; i + 32 <= n; i += 32) {
+    const __m256i c = _mm256_loadu_si256((const __m256i *)(codes + i));
+    const __m256i u = _mm256_loadu_si256((const __m256i *)(upper + i));
+    const __m256i l = _mm256_loadu_si256((const __m256i *)(lower + i));
+    const unsigned int mu = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(c, u), u));
+    const unsigned int ml = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(c, l), l));
+    if ((mu | ml) != 0) {
+      if (*first_fail == n) {
+        *first_fail = i + (size_t)__builtin_ctz(mu | ml);
+      }
+      up += (size_t)__builtin_popcount(mu);
+      low += (size_t)__builtin_popcount(ml);
+    }
+  }
+#endif
+#ifdef __SSE2__
+  for (; i + 16 <= n; i += 16) {
+    const __m128i c = _mm_loadu_si128((const __m128i *)(codes + i));
+    const __m128i u = _mm_loadu_si128((const __m128i *)(upper + i));
+    const __m128i l = _mm_loadu_si128((const __m128i *)(lower + i));
+    const unsigned int mu = ~(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(c, u), u)) & 0xffff;
+    const unsigned int ml = ~(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(c, l), l)) & 0xffff;
+    if ((mu | ml) != 0) {
+      if (*first_fail == n) {
+        *first_fail = i + (size_t)__builtin_ctz(mu | ml);
+      }
+      up += (size_t)__builtin_popcount(mu);
+      low += (size_t)__builtin_popcount(ml);
+    }
+  }
+#endif
+  for (; i < n; i++) {
+    const bool a = (codes[i] > upper[i]);
+    const bool b = (codes[i] < lower[i]);
+    if ((a || b) && (*first_fail == n)) {
+      *first_fail = i;
+    }
+    up += a;
+    low += b;
+  }
+  *above = up;
+  *below = low;
+}
+
+
+/** Code of voltage v in the vertical setup of trace t */
+static double trace_code(const famos_trace_t *t, const double v)
+{
+  return 128.0 + 128.0*(v + t->offset_voltage)/t->mesial_voltage;
+}
+
+
+/** Translate the masks into the codes of a trace with another volts/div.
+ *
+ * A mask beyond the codes of the trace cannot be saturated, code 0 would
+ * pass an upper mask it exceeds. Such a sample is flagged as forced and
+ * its mask opened up, so that the compare does not count it twice.
+ */
+static void translate_masks(limit_t *lim, const famos_trace_t *trace)
+{
+  if (lim->upper_trace == NULL) {
+    lim->upper_trace = malloc(lim->n);
+    lim->lower_trace = malloc(lim->n);
+    lim->forced = malloc(lim->n);
+    if ((lim->upper_trace == NULL) || (lim->lower_trace == NULL) || (lim->forced == NULL)) {
+      printf("limit: out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  lim->num_forced = 0;
+  for (size_t i = 0; i < lim->n; i++) {
+    double u = floor(trace_code(trace, famos_voltage(&lim->header, lim->upper[i])));
+    double l = ceil(trace_code(trace, famos_voltage(&lim->header, lim->lower[i])));
+    uint8_t forced = 0;
+    if (u < 0.0) {
+      forced |= LIMIT_FORCED_ABOVE;
+      u = 255.0;
+    }
+    if (l > 255.0) {
+      forced |= LIMIT_FORCED_BELOW;
+      l = 0.0;
+    }
+    lim->upper_trace[i] = (u > 255.0) ? 255 : (uint8_t)u;
+    lim->lower_trace[i] = (l < 0.0) ? 0 : (uint8_t)l;
+    lim->forced[i] = forced;
+    lim->num_forced += (forced != 0);
+  }
+}
+
+
+static bool limit_open(sink_t *sink, const sink_source_t *src)
+{
+  limit_t *lim = sink->state;
+  const famos_trace_t *trace = src->trace;
+
+  lim->skip = false;
+  lim->mismatch = NULL;
+  lim->checked = 0;
+  lim->first_fail = SIZE_MAX;
+  lim->above = lim->below = 0;
+  if (trace->samples == NULL) {
+    printf("Note: only raw track files can be checked against the limit masks\n");
+    lim->skip = true;
+    return true;
+  }
+  /* the masks are compared sample by sample, a trace on another time
+   * axis gets a verdict of its own instead of a partial check */
+  if (trace->num_samples != lim->n) {
+    lim->mismatch = "sample count differs from the masks";
+  } else if ((trace->sample_rate != lim->header.sample_rate) ||
+             (trace->trigger_delay != lim->header.trigger_delay)) {
+    lim->mismatch = "time base differs from the masks";
+  }
+  if (lim->mismatch != NULL) {
+    lim->skip = true;
+    return true;
+  }
+  if ((trace->mesial_voltage != lim->header.mesial_voltage) ||
+      (trace->offset_voltage != lim->header.offset_voltage)) {
+    translate_masks(lim, trace);
+  } else {
+    free(lim->upper_trace);
+    free(lim->lower_trace);
+    free(lim->forced);
+    lim->upper_trace = lim->lower_trace = lim->forced = NULL;
+    lim->num_forced = 0;
+  }
+  return true;
+}
+
+
+static void limit_write(sink_t *sink, const sink_block_t *blk)
+{
+  limit_t *lim = sink->state;
+  if (lim->skip || (blk->first >= lim->n)) {
+    return;
+  }
+  const size_t n = (blk->first + blk->n <= lim->n) ? blk->n : lim->n - blk->first;
+  const uint8_t *upper = (lim->upper_trace != NULL) ? lim->upper_trace : lim->upper;
+  const uint8_t *lower = (lim->lower_trace != NULL) ? lim->lower_trace : lim->lower;
+  size_t first_fail, above, below;
+  limit_compare(blk->codes, upper + blk->first, lower + blk->first, n, &first_fail, &above, &below);
+  for (size_t i = 0; (lim->num_forced > 0) && (i < n); i++) {
+    const uint8_t forced = lim->forced[blk->first + i];
+    if ((forced != 0) && (i < first_fail)) {
+      first_fail = i;
+    }
+    above += ((forced & LIMIT_FORCED_ABOVE) != 0);
+    below += ((forced & LIMIT_FORCED_BELOW) != 0);
+  }
+  if ((first_fail < n) && (lim->first_fail == SIZE_MAX)) {
+    lim->first_fail = blk->first + first_fail;
+  }
+  lim->above += above;
+  lim->below += below;
+  lim->checked += n;
+}
+
+
+static bool limit_close(sink_t *sink, const sink_source_t *src)
+{
+  limit_t *lim = sink->state;
+  if (lim->skip && (lim->mismatch == NULL)) {
+    return true;
+  }
+  const bool pass = !lim->skip && (lim->first_fail == SIZE_MAX);
+  lim->traces++;
+  lim->failures += !pass;
+  if (lim->skip) {
+    printf("Limit test SKIP: %s (%zu samples, the masks %zu)\n", lim->mismatch,
+           src->trace->num_samples, lim->n);
+  } else if (pass) {
+    printf("Limit test PASS: %zu samples within the masks\n", lim->checked);
+  } else {
+    printf("Limit test FAIL: first violation at sample %zu (%e s), %zu above, %zu below\n",
+           lim->first_fail, famos_time(src->trace, lim->first_fail), lim->above, lim->below);
+  }
+  printf("Limit test: %lu of %lu traces failed\n", lim->failures, lim->traces);
+  if (lim->log_file == NULL) {
+    return true;
+  }
+
+  FILE *fd = fopen(lim->log_file, "a");
+  if (fd == NULL) {
+    printf("cannot write %s\n", lim->log_file);
+    return false;
+  }
+  fseek(fd, 0, SEEK_END);
+  if (ftell(fd) == 0) {
+    fprintf(fd, "#Date \t File \t Result \t First violation \t Time [s] \t Above \t Below \t Checked \t Note\n");
+  }
+  char stamp[32];
+  const time_t now = time(NULL);
+  strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+  if (lim->skip) {
+    fprintf(fd, "%s \t %s \t SKIP \t - \t - \t 0 \t 0 \t 0 \t %s\n", stamp, src->file,
+            lim->mismatch);
+  } else if (pass) {
+    fprintf(fd, "%s \t %s \t PASS \t - \t - \t 0 \t 0 \t %zu \t -\n", stamp, src->file,
+            lim->checked);
+  } else {
+    fprintf(fd, "%s \t %s \t FAIL \t %zu \t %.7e \t %zu \t %zu \t %zu \t -\n", stamp, src->file,
+            lim->first_fail, famos_time(src->trace, lim->first_fail), lim->above, lim->below,
+            lim->checked);
+  }
+  return (fclose(fd) == 0);
+}
+
+
+/* documented in limit.h */
+void limit_sink(sink_t *sink, limit_t *lim)
+{
+  memset(sink, 0, sizeof(*sink));
+  sink->name = "limit";
+  sink->open = limit_open;
+  sink->write = limit_write;
+  sink->close = limit_close;
+  sink->state = lim;
+  sink->codes_only = true;
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,119 @@
+/** \file limit.h
+ * \brief Limit mask pass/fail test of captured traces interface
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup limit
+ * @{
+ */
+
+#ifndef LIMIT_H
+#define LIMIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "famos.h"
+#include "sink.h"
+
+
+/** The upper mask lies below the lowest code of the trace */
+#define LIMIT_FORCED_ABOVE 1
+/** The lower mask lies above the highest code of the trace */
+#define LIMIT_FORCED_BELOW 2
+
+
+/** Upper and lower mask as downloaded with :TRANsfer:LIMIT:UPper/LOWer */
+typedef struct {
+  /** setup of the masks (samples is NULL) */
+  famos_trace_t header;
+  size_t n;
+  uint8_t *upper;
+  uint8_t *lower;
+  /** masks translated to the vertical setup of the checked trace */
+  uint8_t *upper_trace;
+  uint8_t *lower_trace;
+  /** per sample LIMIT_FORCED_* flags where a translated mask lies beyond
+   *  the codes of the trace, such samples fail whatever their code */
+  uint8_t *forced;
+  size_t num_forced;
+  /** result of the trace currently fed by the sink */
+  bool skip;
+  /** why the trace cannot be compared with the masks, NULL if it is */
+  const char *mismatch;
+  size_t checked;
+  size_t first_fail;
+  size_t above;
+  size_t below;
+  /** pass/fail log, appended after every trace */
+  const char *log_file;
+  /** number of checked and of failed traces */
+  unsigned long traces;
+  unsigned long failures;
+} limit_t;
+
+
+/** Decode the two mask track files.
+ *
+ * \return false if a mask has no samples or the lengths differ
+ */
+bool limit_init(limit_t *lim, const void *upper, const size_t upper_count,
+                const void *lower, const size_t lower_count);
+
+
+/** Names of the cached masks for the base file name (*_upper.dat, *_lower.dat) */
+void limit_cache_files(const char *base, char *upper, char *lower, const size_t size);
+
+
+/** Load the cached masks, false if they are not cached (yet) */
+bool limit_load(limit_t *lim, const char *base);
+
+
+/** Release the masks */
+void limit_free(limit_t *lim);
+
+
+/** Count the codes above upper and below lower.
+ *
+ * Compares 16 (SSE2) or 32 (AVX2) codes per step.
+ *
+ * \param first_fail index of the first violation or n if there is none
+ */
+void limit_compare(const uint8_t *codes, const uint8_t *upper, const uint8_t *lower,
+                   const size_t n, size_t *first_fail, size_t *above, size_t *below);
+
+
+/** Register a sink which checks the codes of a trace against the masks.
+ *
+ * The verdict is printed and appended to lim->log_file (if set).
+ */
+void limit_sink(sink_t *sink, limit_t *lim);
+
+
+/** @} */
+
+#endif /* !LIMIT_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
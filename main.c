@@ -33,12 +33,26 @@
 #include <termios.h>
 #include <regex.h>
 #include <time.h>
+#include <math.h>
 #include "serial-setup.h"
+#include "famos.h"
+#include "catalog.h"
+#include "spectrum.h"
+#include "sink.h"
+#include "trace.h"
+#include "diff.h"
+#include "average.h"
+#include "merge.h"
+#include "synth.h"
+#include "segment.h"
+#include "journal.h"
+#include "limit.h"
+#include "convert.h"
 
 
 #define UART_BAUDRATE 9600UL
 
-#define MAX_BUF_SIZE (1024*1024)
+#define MAX_BUF_SIZE FAMOS_MAX_FILE_SIZE
 
 
 typedef struct {
@@ -47,6 +61,11 @@ typedef struct {
 } trancmd_t;
 
 
+/* session journal, recorded with -J or replayed instead of the device with -R */
+static enum { LINK_SERIAL, LINK_RECORD, LINK_REPLAY } link_mode = LINK_SERIAL;
+static journal_t journal;
+
+
 char printable(const char ch)
 {
   if ((32 <= ch) && (ch < 127)) {
@@ -119,51 +138,80 @@ timer_poll_timeout(const struct timespec *timer_start, struct timespec *timer_ac
   return(time_elapsed > thresh);
 }
 
+/* flushes the journal also when the program ends with an error */
+void
+close_journal (void)
+{
+  if (link_mode == LINK_RECORD){
+    journal_close(&journal);
+  }else if (link_mode == LINK_REPLAY){
+    journal_free(&journal);
+  }
+  link_mode = LINK_SERIAL;
+}
+
+
+/* reads what the serial link (or the replayed journal) has received so far,
+ * returns -1 if a replayed response is complete */
+ssize_t
+link_read (const int fd, void *buf, const size_t size)
+{
+  if (link_mode == LINK_REPLAY){
+    return journal_read(&journal, buf, size);
+  }
+  const ssize_t n = read(fd, buf, size);
+  if (n <= 0){
+    return 0;
+  }
+  if (link_mode == LINK_RECORD){
+    journal_record(&journal, JOURNAL_RX, buf, (size_t)n);
+  }
+  return n;
+}
+
+
+/* appends the received bytes to buf, returns false at the end of a replayed response */
+bool
+receive_chunk (const int fd, char *buf, size_t *count, int *receive_state)
+{
+  char ch;
+  //the last byte of the buffer is only used to detect an over run
+  const bool full = (*count == MAX_BUF_SIZE);
+  const ssize_t n = link_read(fd, full ? &ch : buf + *count, full ? 1 : MAX_BUF_SIZE - *count);
+  if (n <= 0){
+    return (n == 0);
+  }
+  if (full) {
+    printf("data buffer over run (too much data received - increase buffer)\n");
+    exit(EXIT_FAILURE);
+  }
+  static const char spinner[] = "\\|/-";
+  printf("Receiving << %c \r", spinner[*receive_state]);
+  *receive_state = (*receive_state + 1) % 4;
+  fflush(stdout);
+  (*count) += (size_t)n;
+  return true;
+}
+
+
 void
 get_plotdata (const int fd, char *buf, size_t *count, double timer1_thresh, double timer2_thresh)
 {
   int receive_state = 0;
-  char ch;
   int key_pressed = 0;
   bool timeout = false;
   bool get_data = false;
+  bool more = true;
   struct timespec timer_start = {0,0}, timer_act = {0,0};
 
   reset_timer(&timer_start);
   (*count) = 0;
   printf("press now the plot-button or press <ESC> to cancel transmission\n");
-  while ((key_pressed != 0x1b) && (!timeout)){
-    if (read(fd, &ch, 1)){
-         get_data = true;
-        //printf("Rx << 0x%x  \r", (int)(ch)&0xff);
-         switch (receive_state) {
-            case 0:
-              printf("Receiving << \\ \r");
-            break;
-            case 1:
-              printf("Receiving << | \r");
-            break;
-            case 2:
-              printf("Receiving << / \r");
-            break;
-            case 3:
-              printf("Receiving << - \r");
-            break;
-            default:
-            break;
-        }
-        if (receive_state == 3) {
-           receive_state = 0;
-        }else{
-           receive_state ++;
-        }
-        if (*count == MAX_BUF_SIZE) {
-          printf("data buffer over run (too much data received - increase buffer)\n");
-          exit(EXIT_FAILURE);
-        }
-        fflush(stdout);
-        buf[*count] = ch;
-        (*count)++;
+  while ((key_pressed != 0x1b) && (!timeout) && more){
+    const size_t before = *count;
+    more = receive_chunk(fd, buf, count, &receive_state);
+    if (*count > before){
+        get_data = true;
         reset_timer(&timer_start);
     }
     key_pressed = getkey();
@@ -179,49 +227,23 @@ get_plotdata (const int fd, char *buf, size_t *count, double timer1_thresh, doub
 }
 
 
-void
+/* returns false if the transmission was cancelled with <ESC> */
+bool
 get_trackdata (const int fd, char *buf, size_t *count, double timer_thresh)
 {
   int receive_state = 0;
-  char ch;
   int key_pressed = 0;
   bool timeout = false;
+  bool more = true;
   struct timespec timer_start = {0,0}, timer_act = {0,0};
 
   reset_timer(&timer_start);
   (*count) = 0;
   printf("press <ESC> to cancel transmission\n");
-  while ((key_pressed != 0x1b) && (!timeout)){
-    if (read(fd, &ch, 1)){
-        //printf("Rx << 0x%x  \r", (int)(ch)&0xff);
-         switch (receive_state) {
-            case 0:
-              printf("Receiving << \\ \r");
-            break;
-            case 1:
-              printf("Receiving << | \r");
-            break;
-            case 2:
-              printf("Receiving << / \r");
-            break;
-            case 3:
-              printf("Receiving << - \r");
-            break;
-            default:
-            break;
-        }
-        if (receive_state == 3) {
-           receive_state = 0;
-        }else{
-           receive_state ++;
-        }
-        if (*count == MAX_BUF_SIZE) {
-          printf("data buffer over run (too much data received - increase buffer)\n");
-          exit(EXIT_FAILURE);
-        }
-        fflush(stdout);
-        buf[*count] = ch;
-        (*count)++;
+  while ((key_pressed != 0x1b) && (!timeout) && more){
+    const size_t before = *count;
+    more = receive_chunk(fd, buf, count, &receive_state);
+    if (*count > before){
         reset_timer(&timer_start);
     }
     key_pressed = getkey();
@@ -230,6 +252,7 @@ get_trackdata (const int fd, char *buf, size_t *count, double timer_thresh)
     timeout = timer_poll_timeout(&timer_start, &timer_act, timer_thresh);
   }
   printf ("<< %d bytes received \n", (int)(*count));
+  return (key_pressed != 0x1b);
 }
 
 
@@ -237,6 +260,13 @@ void
 send_cmd (const int fd, const char *buf, const size_t len)
 {
   printf( "TX >> %.*s \n", (int)(len), buf);
+  if (link_mode == LINK_REPLAY){
+    journal_expect(&journal, buf, len);
+    return;
+  }
+  if (link_mode == LINK_RECORD){
+    journal_record(&journal, JOURNAL_TX, buf, len);
+  }
   const char ch = 0x0A;
   write (fd, buf, len);
   write (fd, &ch, 1);
@@ -265,148 +295,229 @@ void save_disc(const char *file, const void *buf, const size_t count)
 }
 
 
-void convert_and_save_disc(const char *file, const void *buf, const size_t count)
+/* reads a track file from disc into buf */
+void read_disc(const char *file, void *buf, size_t *count)
 {
-  FILE *fd1,*fd2;
+  FILE *fd = fopen (file, "r");
 
-  if (file == NULL){
-    fd1 = fopen ("log.dat", "w");
-    fd2 = fopen ("log.csv", "w");
-    printf( "no output file specified - storing under default './log.*'\n");
+  if (fd == NULL){
+    printf("cannot open %s\n", file);
+    exit(EXIT_FAILURE);
   }
-  else {
-    fd1 = fopen (file, "w");
-    //exchange file extension if there is one
-    char fileexp[256];
-    memset(fileexp, 0, sizeof(fileexp));
-    strcpy(fileexp,file);
-    char *pExt = strrchr(fileexp, '.');
-    if (pExt != NULL)
-       strcpy(pExt, ".csv");
-    else
-       strcat(fileexp, ".csv");
-    printf("Exporting FAMOS track file to CSV: %s\n", fileexp);
-    fd2 = fopen (fileexp, "w");
-  }
-
-  if ((fd1 == NULL) | (fd2 == NULL)){
+  *count = fread(buf, 1, MAX_BUF_SIZE, fd);
+  if (!feof(fd)){
+    printf("%s: file too large (increase buffer)\n", file);
     exit(EXIT_FAILURE);
   }
-  rewind(fd1);
-  fwrite(buf, 1, count, fd1);
-  fclose(fd1);
-  printf("%zd bytes written\n", count);
+  fclose(fd);
+}
 
-  char str[256];
-  long double mesialVoltage, offsetVoltage, sampleRate, triggerDelay;
-
-  int r;
-  regex_t reg;
-  regmatch_t match[5];
-
-  /*
-  |CD,1,a,1,b,c,d,e;
-    X-axis:
-    a=sample rate (default 1. for ext clock)
-    b=trigger delay
-    c=0 for ext clock,1 for DSO timebase
-    d=length of e string (1 or 6)
-    e=EXTCLK or s (s=seconds)
-
-    we search for one or more character not containing ',' which are separated by ','
-  */
-  regcomp(&reg, "\\|CD,1,([^,]+),1,([^,]+),([^,]+),[^,]+,[^,]+;", REG_EXTENDED);
-  r=regexec(&reg, buf, 4, match, 0);
-  if (r == 0)
-  {
-    fprintf(fd2,"#X-Axis:\n");
-    fprintf(fd2,"#Samplerate:        \t%.*s\n", match[1].rm_eo - match[1].rm_so, (unsigned char *)(buf) + match[1].rm_so);
-    strncpy(str, buf + match[1].rm_so, match[1].rm_eo - match[1].rm_so);
-    sscanf(str, "%Lf", &sampleRate);
-    printf("Samplerate: %Le\n",sampleRate);
-    fprintf(fd2,"#Trigger delay:     \t%.*s\n", match[2].rm_eo - match[2].rm_so, (unsigned char *)(buf) + match[2].rm_so);
-    strncpy(str, buf + match[2].rm_so, match[2].rm_eo - match[2].rm_so);
-    sscanf(str, "%Lf", &triggerDelay);
-    printf("Trigger Delay: %Le\n",triggerDelay);
-    const char *ch = (buf + match[3].rm_so);
-    if (*ch == '0'){
-      fprintf(fd2,"#Time base:       \tExt clock\n");
-    }else if(*ch == '1'){
-      fprintf(fd2,"#Time base:        \tDSO timebase\n");
-    } else {
-      fprintf(fd2,"#Error: unknown timebase field\n");
-    };
-  }else{
-    printf("Note: No horizontal setup found\n");
-  }
-
-  /*
-  |CR,1,1,0,1,0.,255.,0.,255.,a,b,c,d,e;
-    Y-axis:
-    a=mesial voltage
-    b=offset in volts
-    c=1 if variable volts/div off, else 0
-    d=length of e string (1 or 4)
-    e=V if variable volts/div off, else V NC
-
-    we search for one or more character not containing ',' which are separated by ','
-  */
-  regcomp(&reg, "\\|CR,1,1,0,1,[^,]+,[^,]+,[^,]+,[^,]+,([^,]+),([^,]+),([^,]+),[^,]+,[^,]+;",REG_EXTENDED);
-  r=regexec(&reg, buf, 4, match, 0);
-  if (r == 0)
-  {
-    fprintf(fd2,"#Y-Axis:\n");
-    fprintf(fd2,"#Mesial voltage:    \t%.*s\n", match[1].rm_eo - match[1].rm_so, (unsigned char *)(buf) + match[1].rm_so);
-    strncpy(str, buf + match[1].rm_so, match[1].rm_eo - match[1].rm_so);
-    sscanf(str, "%Lf", &mesialVoltage);
-    printf("Mesial Voltage: %Le\n",mesialVoltage);
-    fprintf(fd2,"#Offset in volts:   \t%.*s\n", match[2].rm_eo - match[2].rm_so, (unsigned char *)(buf) + match[2].rm_so);
-    strncpy(str, buf + match[2].rm_so, match[2].rm_eo - match[2].rm_so);
-    sscanf(str, "%Lf", &offsetVoltage);
-    printf("Offset Voltage: %Le\n",offsetVoltage);
-    const char *ch = (buf + match[3].rm_so);
-    if (*ch == '0'){
-      fprintf(fd2,"#Variable volts/div on\n");
-    }else if(*ch == '1'){
-      fprintf(fd2,"#Variable volts/div off\n");
-    } else {
-      fprintf(fd2,"#Error: variable volts/div\n");
-    };
-  } else{
-    printf("Note: No vertical setup found\n");
-  }
-
-  /*
-  |CS,1,a,b;
-    a=the number of data bytes
-    b=the data itself
-  |CA,1,0000000000;
-    Footer
-  */
-  regcomp(&reg, "\\|CS,1,([0-9]+),(.*);\\|CA,1,0000000000;", REG_EXTENDED);
-  r=regexec(&reg, buf, 4, match, 0);
-  if (r == 0)
-  {
-    fprintf(fd2,"#Number of Samples: \t%.*s\n", match[1].rm_eo - match[1].rm_so, (unsigned char *)(buf) + match[1].rm_so);
-    size_t len = match[2].rm_eo - match[2].rm_so;
-    unsigned char *ch;
-    for (size_t i = 0; i < len; i++){
-      ch = ((unsigned char *)(buf) + match[2].rm_so + i);
-      /* could be either
-         physVoltage=mesialVoltage*(internalVoltage-128.0l)/128.0l-offsetVoltage;
-         or
-         physVoltage=mesialVoltage*(internalVoltage-128.0l)/127.0l-offsetVoltage;
-       */
-      long double physVoltage=mesialVoltage*((long double)(*ch)-128.0l)/128.0l-offsetVoltage;
-      long double timeBase = (long double)(i)*sampleRate-triggerDelay;
-      fprintf(fd2,"%.7Le \t %.7Le\n",timeBase,physVoltage);
+
+/* downloads the upper and the lower limit mask into the cache files */
+void get_limits(const int fd, char *buf, convopt_t *convopt)
+{
+  char upper[256], lower[256];
+  const char *files[2] = { upper, lower };
+  const char *cmds[2] = { "TRAN:LIMIT:UP?", "TRAN:LIMIT:LOW?" };
+  size_t count;
+
+  limit_cache_files(convopt->limit_file, upper, lower, sizeof(upper));
+  for (int i = 0; i < 2; i++){
+    send_cmd(fd, cmds[i], strlen(cmds[i]));
+    if (!get_trackdata (fd, buf, &count, 2.2) || (count == 0)){
+      printf ("No limit mask received\n");
+      exit(EXIT_FAILURE);
     }
-  } else{
-    printf("Note: no datapoints found\n");
+    save_disc(files[i], buf, count);
   }
+  if (!limit_load(&convopt->limit, convopt->limit_file)){
+    exit(EXIT_FAILURE);
+  }
+}
 
-  regfree(&reg);
-  fclose(fd2);
+
+/* downloads the sequences one after the other, every received segment is
+ * converted on a worker thread while the next one is transferred */
+void get_sequences(const int fd, const int *numbers, const size_t num,
+                   const char *out_file, convopt_t *convopt)
+{
+  segment_t segs[SEGMENT_MAX];
+  size_t received = 0;
+  const char *base = (out_file != NULL) ? out_file : "log.dat";
+
+  memset(segs, 0, sizeof(segs));
+  for (size_t i = 0; i < num; i++){
+    segment_t *seg = &segs[received];
+    seg->number = numbers[i];
+    seg->buf = malloc(MAX_BUF_SIZE);
+    if (seg->buf == NULL){
+      printf ("Out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+    char cmd[32];
+    const int len = snprintf(cmd, sizeof(cmd), "TRAN:SEQ%d?", seg->number);
+    send_cmd(fd, cmd, (size_t)len);
+    const bool complete = get_trackdata (fd, seg->buf, &seg->count, 2.2);
+    if (seg->count == 0){
+      printf ("No data received for sequence %d\n", seg->number);
+      free(seg->buf);
+      seg->buf = NULL;
+    }else if (!complete){
+      //a cancelled transfer is truncated, it is only listed in the index
+      printf ("Sequence %d cancelled - not converted\n", seg->number);
+      snprintf(seg->file, sizeof(seg->file), "-");
+      seg->incomplete = true;
+      received++;
+    }else{
+      char ext[16];
+      snprintf(ext, sizeof(ext), "_seq%d.dat", seg->number);
+      famos_exchange_ext(seg->file, sizeof(seg->file), base, ext);
+      seg->outputs = convopt->outputs;
+      segment_start(seg);
+      received++;
+    }
+    if (!complete){
+      break;
+    }
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < received; i++){
+    if (!segs[i].incomplete){
+      ok = segment_join(&segs[i]) && ok;
+    }
+  }
+  //the catalogue, the average and the limit test are shared, they are updated in order after the workers
+  for (size_t i = 0; i < received; i++){
+    const segment_t *seg = &segs[i];
+    if (!seg->ok){
+      continue;
+    }
+    catalog_disc(seg->file, seg->buf, seg->count, &seg->trace, convopt);
+    if (seg->trace.samples != NULL){
+      sink_t sinks[2];
+      size_t num_sinks = 0;
+      sink_source_t src;
+      memset(&src, 0, sizeof(src));
+      src.file = seg->file;
+      src.trace = &seg->trace;
+      src.num_samples = seg->trace.num_samples;
+      if (convopt->average_file != NULL){
+        average_sink(&sinks[num_sinks++], &convopt->average);
+      }
+      if (convopt->limit.n > 0){
+        limit_sink(&sinks[num_sinks++], &convopt->limit);
+      }
+      ok = sink_run(sinks, num_sinks, &src) && ok;
+    }
+  }
+  char index[256];
+  famos_exchange_ext(index, sizeof(index), base, "_seq.csv");
+  printf ("Sequence index of %zu segments: %s\n", received, index);
+  if (!segment_write_index(segs, received, index)){
+    printf ("cannot write %s\n", index);
+    ok = false;
+  }
+  finish_conversions(convopt);
+  for (size_t i = 0; i < received; i++){
+    free(segs[i].buf);
+  }
+  if (!ok){
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+/* subtracts the (scaled) background from every trace, the results are
+ * stored under out_file or <trace>_diff.* */
+void diff_files(const char *background, const double scale, const char *out_file,
+                const int num_files, char * const *files, const sink_opt_t *outputs)
+{
+  trace_data_t bg, a;
+  sink_t sinks[SINK_MAX];
+  diff_t d;
+
+  if (!trace_load(&bg, background)){
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < num_files; i++){
+    if (!trace_load(&a, files[i])){
+      exit(EXIT_FAILURE);
+    }
+    if (!diff_init(&d, &a, &bg, scale)){
+      printf("%s and %s do not overlap in time\n", files[i], background);
+      exit(EXIT_FAILURE);
+    }
+    char fileexp[256];
+    if (out_file != NULL){
+      snprintf(fileexp, sizeof(fileexp), "%s", out_file);
+    }else{
+      famos_exchange_ext(fileexp, sizeof(fileexp), files[i], "_diff.dat");
+    }
+    printf("%s - %g * %s: %zu samples (%s)\n", files[i], scale, background, d.n,
+           d.same_grid ? "same sample grid" : "interpolated");
+
+    sink_source_t src;
+    memset(&src, 0, sizeof(src));
+    src.file = fileexp;
+    src.trace = &d.header;
+    src.num_samples = d.n;
+    src.fetch = diff_fetch;
+    src.ctx = &d;
+    if (!sink_run(sinks, sink_select(sinks, outputs), &src)){
+      exit(EXIT_FAILURE);
+    }
+    trace_free(&a);
+  }
+  trace_free(&bg);
+}
+
+
+/* resamples the track files onto a common time grid and writes them as columns */
+void merge_files(const merge_opt_t *mopt, const char *out_file,
+                 const int num_files, char * const *files, const sink_opt_t *outputs)
+{
+  trace_data_t *traces = calloc((size_t)num_files, sizeof(trace_data_t));
+  merge_t m;
+
+  if (traces == NULL){
+    printf ("Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  if (outputs->raw || outputs->env || outputs->stats || outputs->fft || outputs->events){
+    printf ("A merge is written as csv or bin only\n");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < num_files; i++){
+    if (!trace_open(&traces[i], files[i])){
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (!merge_init(&m, traces, (size_t)num_files, mopt)){
+    printf ("The track files do not overlap in time\n");
+    exit(EXIT_FAILURE);
+  }
+  char csvfile[256], binfile[256];
+  const char *base = (out_file != NULL) ? out_file : "merge.csv";
+  famos_exchange_ext(csvfile, sizeof(csvfile), base, ".csv");
+  famos_exchange_ext(binfile, sizeof(binfile), base, ".bin");
+  const bool csv = outputs->csv || !outputs->bin;
+  printf ("Merging %d channels: %zu samples, step %e s\n", num_files,
+          m.header.num_samples, m.header.sample_rate);
+  if (csv){
+    printf ("Exporting merged channels to CSV: %s\n", csvfile);
+  }
+  if (outputs->bin){
+    printf ("Exporting merged channels as binary rows: %s\n", binfile);
+  }
+  if (!merge_save(&m, csv ? csvfile : NULL, outputs->bin ? binfile : NULL, files)){
+    exit(EXIT_FAILURE);
+  }
+  merge_free(&m);
+  for (int i = 0; i < num_files; i++){
+    trace_free(&traces[i]);
+  }
+  free(traces);
 }
 
 
@@ -414,7 +525,16 @@ void
 print_help(void)
 {
     printf("\n\r  SYNOPSIS\n\r");
-    printf("         dso_serial -d device -o output [-n runnumber] [-p tracename] [-s]\n\r\n\r");
+    printf("         dso_serial -d device -o output [-n runnumber] [-p tracename] [-s] [-r repeat]\n\r");
+    printf("                    [-c catalogue] [-O outputs] [-F spectrum] [-E events]\n\r");
+    printf("                    [-A average] [-L masks]\n\r");
+    printf("         dso_serial -d device -o output -S sequences [-c catalogue] [-O outputs] [-A average]\n\r");
+    printf("         dso_serial -R journal[,max] [download options]\n\r");
+    printf("         dso_serial -i [-c catalogue] [-O outputs] [-F spectrum] [-E events] trackfile.dat ...\n\r");
+    printf("         dso_serial -D background [-k scale] [-O outputs] [-o output] trackfile ...\n\r");
+    printf("         dso_serial -M method[,step] [-O csv,bin] [-o output] trackfile trackfile ...\n\r");
+    printf("         dso_serial -G shape[,samples[,rate[,frequency[,amplitude[,noise]]]]] -o output\n\r");
+    printf("         dso_serial -c catalogue -q filter [-q filter ...]\n\r\n\r");
     printf("  DESCRIPTION\n\r");
     printf("         DSO GOULD 650 and DataSys 9xx RS-423 via RS-232 downloader\n\r\n\r");
     printf("  OPTIONS\n\r");
@@ -425,13 +545,92 @@ print_help(void)
     printf("         -p tracename string data\n\r");
     printf("                tracename to be downloaded\n\r");
     printf("                if a FAMOS file is recognized the data is converted to *.csv as well\n\r\n\r");
+    printf("         -r repeat\n\r");
+    printf("                download the trace repeat times (0: until <ESC>), the captures\n\r");
+    printf("                are stored as output_0001.dat, output_0002.dat, ...\n\r\n\r");
+    printf("         -S sequences\n\r");
+    printf("                download the acquisition sequences (e.g. 1-8 or 1,3,5) back to back,\n\r");
+    printf("                each segment is converted on a worker thread while the next one is\n\r");
+    printf("                transferred and stored as output_seqN.dat, the segments are listed\n\r");
+    printf("                in output_seq.csv\n\r\n\r");
+    printf("         -J journal\n\r");
+    printf("                record every command and every received chunk with its time stamp\n\r");
+    printf("                in the binary session journal\n\r\n\r");
+    printf("         -R journal[,max]\n\r");
+    printf("                replay a session journal instead of talking to a device (give the\n\r");
+    printf("                options of the recorded session), at the recorded pace or with max\n\r");
+    printf("                as fast as possible\n\r\n\r");
+    printf("         -x\n\r");
+    printf("                print a hexdump of the received data\n\r\n\r");
     printf("         -o output file\n\r");
     printf("                output file for downloaded trace data\n\r\n\r");
     printf("         -d device\n\r");
     printf("                device file for serial data transfer\n\r\n\r");
+    printf("         -i\n\r");
+    printf("                convert FAMOS track files given as arguments to *.csv (no device needed)\n\r\n\r");
+    printf("         -D background\n\r");
+    printf("                subtract the background trace (.dat or .csv) from the track files given\n\r");
+    printf("                as arguments, both are aligned on their time axes, the result is\n\r");
+    printf("                written to <trackfile>_diff.* (or -o if there is only one track file)\n\r\n\r");
+    printf("         -k scale\n\r");
+    printf("                scale factor of the background (default 1)\n\r\n\r");
+    printf("         -M method[,step]\n\r");
+    printf("                merge the track files given as arguments (.dat or .csv) into one file\n\r");
+    printf("                with a time column and one column per trace over their common time\n\r");
+    printf("                span, method is nearest, linear or sinc (8 tap windowed sinc), the\n\r");
+    printf("                grid step defaults to the finest sample rate, the result is written\n\r");
+    printf("                to output.csv and/or output.bin (default merge.csv)\n\r\n\r");
+    printf("         -G shape[,samples[,rate[,frequency[,amplitude[,noise]]]]]\n\r");
+    printf("                write a synthetic FAMOS track file to output, shape is sine, square,\n\r");
+    printf("                triangle, ramp, pulse or noise (default 20000 samples at 1e-6 s,\n\r");
+    printf("                1e3 Hz, 1 V amplitude, no noise, 0.64 V/div)\n\r\n\r");
+    printf("         -A average\n\r");
+    printf("                add every converted trace to the ensemble average kept in the state\n\r");
+    printf("                file average, mean, std deviation, min and max are written to\n\r");
+    printf("                average.csv after each trace (traces with other setup are skipped)\n\r\n\r");
+    printf("         -L masks\n\r");
+    printf("                check every converted trace against the limit masks of the DSO, the\n\r");
+    printf("                masks are downloaded once (:TRANsfer:LIMIT:UPper/LOWer) and cached as\n\r");
+    printf("                masks_upper.dat and masks_lower.dat, the verdict, first violation and\n\r");
+    printf("                number of samples above/below are appended to masks_limit.log\n\r\n\r");
+    printf("         -c catalogue\n\r");
+    printf("                record the metadata of every converted track file in the catalogue\n\r\n\r");
+    printf("         -F window[,segment[,zeropad[,bin]]]\n\r");
+    printf("                add the spectrum of converted tracks to the outputs (*_fft.csv or *_fft.bin)\n\r");
+    printf("                window is rect, hann, hamming, blackman or flattop, segment is the\n\r");
+    printf("                length of the averaged segments (default whole trace) and zeropad\n\r");
+    printf("                the zero padding factor\n\r\n\r");
+    printf("         -E level=V[,hyst=V][,min=T][,max=T][,runt=V][,range]\n\r");
+    printf("                add the software trigger events of converted tracks to the outputs:\n\r");
+    printf("                rising/falling edges through level with hysteresis hyst, positive\n\r");
+    printf("                pulses narrower than min or wider than max seconds, runts crossing\n\r");
+    printf("                runt but not level and runs of out of range samples, written to\n\r");
+    printf("                *_events.csv and the index *_events.idx (sample, time, type, width)\n\r\n\r");
+    printf("         -O output[,output ...]\n\r");
+    printf("                outputs of a conversion, all written in one pass (default csv):\n\r");
+    printf("                raw (track file), csv, bin (time/voltage doubles), env[:N] (min/max\n\r");
+    printf("                of every N samples), stats (min/max/mean/rms), fft (see -F), events (see -E)\n\r\n\r");
+    printf("         -q filter\n\r");
+    printf("                query the catalogue, filter is key=value, key<value, key<=value,\n\r");
+    printf("                key>value or key>=value with key one of rate, delay, timebase,\n\r");
+    printf("                mesial, offset, date, samples, dso, path (shell pattern), hash\n\r");
+    printf("                several filters have to match all\n\r\n\r");
     printf("  EXAMPLES\n\r");
     printf("         ./dso_serial -d /dev/ttyUSB0 -o plot.hpgl -s\n\r");
-    printf("         ./dso_serial -d /dev/ttyUSB0 -o trace1.dat -n 20 -p TR1_5K0.DAT\n\r\n\r");
+    printf("         ./dso_serial -d /dev/ttyUSB0 -o trace1.dat -n 20 -p TR1_5K0.DAT\n\r");
+    printf("         ./dso_serial -d /dev/ttyUSB0 -o burst.dat -S 1-8 -O csv,stats\n\r");
+    printf("         ./dso_serial -d /dev/ttyUSB0 -o trace1.dat -n 20 -p TR1_5K0.DAT -J session.jnl\n\r");
+    printf("         ./dso_serial -R session.jnl,max -o trace1.dat -n 20 -p TR1_5K0.DAT\n\r");
+    printf("         ./dso_serial -i -c traces.cat archive/*.dat\n\r");
+    printf("         ./dso_serial -i -F hann,1024,4 trace1.dat\n\r");
+    printf("         ./dso_serial -i -O csv,bin,env:100,stats trace1.dat\n\r");
+    printf("         ./dso_serial -i -E level=1.5,hyst=0.1,min=2e-6,runt=0.5,range trace1.dat\n\r");
+    printf("         ./dso_serial -D background.dat -k 0.5 capture*.dat\n\r");
+    printf("         ./dso_serial -G square,1000000,1e-7,2e4,0.5,0.01 -o test.dat\n\r");
+    printf("         ./dso_serial -M linear -o run7.csv ch1.dat ch2.dat ref1.csv\n\r");
+    printf("         ./dso_serial -d /dev/ttyUSB0 -o cap.dat -n 20 -p TR1_5K0.DAT -r 0 -A avg.state\n\r");
+    printf("         ./dso_serial -d /dev/ttyUSB0 -o dut.dat -n 20 -p TR1_5K0.DAT -r 0 -O stats -L masks.dat\n\r");
+    printf("         ./dso_serial -c traces.cat -q \"dso=DSO 740\" -q rate=2e-7 -q date>=2017-06-01\n\r\n\r");
     printf("  NOTES\n\r");
     printf("  AUTHOR\n\r");
     printf("         samplemaker\n\r\n\r");
@@ -451,11 +650,35 @@ int main(int argc, char *argv[])
   char *out_file = NULL;
   char *device = NULL;
   int opt;
-  const int delay = 300000;
-
-  enum { NONE, SCREENSHOT, GETFILE } mode = NONE;
-
-  while ((opt = getopt(argc, argv, "sn:p:d:o:")) != -1) {
+  int delay = 300000;
+
+  convopt_t convopt;
+  memset(&convopt, 0, sizeof(convopt));
+  //default output of a conversion is the CSV file
+  bool spectrum_given = false;
+  bool events_given = false;
+  convopt.outputs.csv = true;
+  convopt.outputs.env_decimation = 64;
+  spectrum_parse_opt(&convopt.outputs.fft_opt, "hann");
+  events_parse_opt(&convopt.outputs.events_opt, "");
+  /* catalogue query filters */
+  char *filters[32];
+  size_t num_filters = 0;
+
+  char *background = NULL;
+  unsigned long repeat = 1;
+  double scale = 1.0;
+  merge_opt_t merge_opt = { MERGE_LINEAR, 0.0 };
+  synth_opt_t synth_opt;
+  int sequences[SEGMENT_MAX];
+  char *journal_file = NULL;
+  bool replay_max_speed = false;
+  bool dump = false;
+  size_t num_sequences = 0;
+
+  enum { NONE, SCREENSHOT, GETFILE, SEQUENCE, IMPORT, QUERY, DIFF, MERGE, GENERATE } mode = NONE;
+
+  while ((opt = getopt(argc, argv, "sn:p:d:o:ic:q:F:O:D:k:A:r:E:M:G:S:J:R:xL:")) != -1) {
     switch (opt) {
       case 's': mode = SCREENSHOT; break;
       case 'p': trancmd.tracename = strdup(optarg); //duplicates into a null terminated string
@@ -465,34 +688,227 @@ int main(int argc, char *argv[])
                 printf ("Run number: \"%s\"\n", trancmd.runnumber); break;
       case 'd': device = strdup(optarg); break; //duplicates into a null terminated string
       case 'o': out_file = strdup(optarg); break; //duplicates into a null terminated string
+      case 'i': mode = IMPORT; break;
+      case 'D': background = strdup(optarg);
+                mode = DIFF; break;
+      case 'M': if (!merge_parse_opt(&merge_opt, optarg)){
+                  printf ("Invalid merge setup \"%s\"\n", optarg);
+                  exit(EXIT_FAILURE);
+                }
+                mode = MERGE; break;
+      case 'J': journal_file = strdup(optarg);
+                link_mode = LINK_RECORD; break;
+      case 'R': journal_file = strdup(optarg);
+                char *speed = strrchr(journal_file, ',');
+                if ((speed != NULL) && (strcmp(speed, ",max") == 0)){
+                  *speed = '\0';
+                  replay_max_speed = true;
+                }
+                link_mode = LINK_REPLAY; break;
+      case 'x': dump = true; break;
+      case 'S': num_sequences = segment_parse_list(optarg, sequences);
+                if (num_sequences == 0){
+                  printf ("Invalid sequence list \"%s\"\n", optarg);
+                  exit(EXIT_FAILURE);
+                }
+                mode = SEQUENCE; break;
+      case 'G': if (!synth_parse_opt(&synth_opt, optarg)){
+                  printf ("Invalid trace setup \"%s\"\n", optarg);
+                  exit(EXIT_FAILURE);
+                }
+                mode = GENERATE; break;
+      case 'k': { char *end;
+                  scale = strtod(optarg, &end);
+                  if ((end == optarg) || (*end != '\0') || !isfinite(scale)){
+                    printf ("Invalid difference scale \"%s\"\n", optarg);
+                    exit(EXIT_FAILURE);
+                  }
+                } break;
+      case 'A': convopt.average_file = strdup(optarg); break;
+      case 'L': convopt.limit_file = strdup(optarg); break;
+      case 'r': { char *end;
+                  repeat = strtoul(optarg, &end, 10);
+                  if ((end == optarg) || (*end != '\0') || (strchr(optarg, '-') != NULL)){
+                    printf ("Invalid repeat count \"%s\"\n", optarg);
+                    exit(EXIT_FAILURE);
+                  }
+                } break;
+      case 'c': convopt.catalog_file = strdup(optarg); break;
+      case 'F': if (!spectrum_parse_opt(&convopt.outputs.fft_opt, optarg)){
+                  printf ("Invalid spectrum setup \"%s\"\n", optarg);
+                  exit(EXIT_FAILURE);
+                }
+                spectrum_given = true; break;
+      case 'E': if (!events_parse_opt(&convopt.outputs.events_opt, optarg)){
+                  printf ("Invalid event setup \"%s\"\n", optarg);
+                  exit(EXIT_FAILURE);
+                }
+                events_given = true; break;
+      case 'O': if (!sink_parse_opt(&convopt.outputs, optarg)){
+                  printf ("Invalid output list \"%s\"\n", optarg);
+                  exit(EXIT_FAILURE);
+                }
+                break;
+      case 'q': if (num_filters == sizeof(filters)/sizeof(filters[0])){
+                  printf ("Too many filters\n");
+                  exit(EXIT_FAILURE);
+                }
+                filters[num_filters++] = strdup(optarg);
+                mode = QUERY; break;
       default:
-          fprintf(stderr, "Usage: %s [sg:n:p:d:o:]\n", argv[0]);
+          fprintf(stderr, "Usage: %s [sn:p:d:o:ic:q:F:O:D:k:A:r:E:M:G:S:J:R:xL:] [trackfile ...]\n", argv[0]);
           exit(EXIT_FAILURE);
       }
   }
   // Now optind (declared extern int by <unistd.h>) is the index of the first non-option argument.
   // If it is >= argc, there were no non-option arguments.
 
-  if (device == NULL){
-    print_help();
-    printf ("No device specified\n");
+  convopt.outputs.fft |= spectrum_given;
+  //there is no sensible default trigger level for the event search
+  if (convopt.outputs.events && !events_given){
+    printf ("The events output needs the trigger setup -E\n");
     exit(EXIT_FAILURE);
   }
-  int fd = serial_open (device);
-  if (fd < 0) {
-    print_help();
-    printf ("Error serial_open()\n");
-    exit(EXIT_FAILURE);
+  convopt.outputs.events |= events_given;
+  //the input of an offline conversion is not written again
+  if (mode == IMPORT){
+    convopt.outputs.raw = false;
   }
 
-  /* 8N1 - 8 bits, no parity, 1 stop bit */
-  serial_setup(fd, UART_BAUDRATE, 8, PARITY_NONE, 1);
+  if (convopt.catalog_file != NULL){
+    if (!catalog_load(&convopt.catalog, convopt.catalog_file)){
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (convopt.average_file != NULL){
+    if (!average_load(&convopt.average, convopt.average_file)){
+      exit(EXIT_FAILURE);
+    }
+  }
+  char limit_log[256];
+  if (convopt.limit_file != NULL){
+    //the masks are downloaded once, later runs take them from the cache
+    if (limit_load(&convopt.limit, convopt.limit_file)){
+      printf ("Limit masks: %zu samples (cached)\n", convopt.limit.n);
+    }else if (mode == IMPORT){
+      printf ("No cached limit masks for %s\n", convopt.limit_file);
+      exit(EXIT_FAILURE);
+    }
+    famos_exchange_ext(limit_log, sizeof(limit_log), convopt.limit_file, "_limit.log");
+    convopt.limit.log_file = limit_log;
+  }
+
+  //offline modes which do not need the serial link
+  switch (mode) {
+     case IMPORT:
+       if (optind >= argc){
+         print_help();
+         printf ("No track files specified\n");
+         exit(EXIT_FAILURE);
+       }
+       for (int i = optind; i < argc; i++){
+         read_disc(argv[i], buf, &count);
+         convert_disc(argv[i], buf, count, &convopt.outputs, &convopt);
+       }
+       finish_conversions(&convopt);
+       exit(EXIT_SUCCESS);
+     case DIFF:
+       if (optind >= argc){
+         print_help();
+         printf ("No track files specified\n");
+         exit(EXIT_FAILURE);
+       }
+       diff_files(background, scale, (argc - optind == 1) ? out_file : NULL,
+                  argc - optind, argv + optind, &convopt.outputs);
+       exit(EXIT_SUCCESS);
+     case MERGE:
+       if (optind >= argc){
+         print_help();
+         printf ("No track files specified\n");
+         exit(EXIT_FAILURE);
+       }
+       merge_files(&merge_opt, out_file, argc - optind, argv + optind, &convopt.outputs);
+       exit(EXIT_SUCCESS);
+     case GENERATE:
+       if (out_file == NULL){
+         print_help();
+         printf ("No output file specified\n");
+         exit(EXIT_FAILURE);
+       }
+       char *track = synth_famos(&synth_opt, &count);
+       if (track == NULL){
+         printf ("Out of memory\n");
+         exit(EXIT_FAILURE);
+       }
+       FILE *fd = fopen(out_file, "w");
+       if ((fd == NULL) || (fwrite(track, 1, count, fd) != count) || (fclose(fd) != 0)){
+         printf ("cannot write %s\n", out_file);
+         exit(EXIT_FAILURE);
+       }
+       printf ("%zd bytes written\n", count);
+       free(track);
+       exit(EXIT_SUCCESS);
+     case QUERY:
+       if (convopt.catalog_file == NULL){
+         print_help();
+         printf ("No catalogue specified\n");
+         exit(EXIT_FAILURE);
+       }
+       const long hits = catalog_query(&convopt.catalog, filters, num_filters);
+       if (hits < 0){
+         exit(EXIT_FAILURE);
+       }
+       printf ("%ld of %zu traces match\n", hits, convopt.catalog.count);
+       exit(EXIT_SUCCESS);
+     default:
+     break;
+  }
+
+  int fd = -1;
+  if (link_mode == LINK_REPLAY){
+    //the journal stands in for the device
+    if (!journal_load(&journal, journal_file, replay_max_speed)){
+      exit(EXIT_FAILURE);
+    }
+    printf ("Replaying %s (%s)\n", journal_file, replay_max_speed ? "maximum speed" : "recorded speed");
+    //the replayed device needs no time to settle after a command
+    if (replay_max_speed){
+      delay = 0;
+    }
+  }else{
+    if (device == NULL){
+      print_help();
+      printf ("No device specified\n");
+      exit(EXIT_FAILURE);
+    }
+    fd = serial_open (device);
+    if (fd < 0) {
+      print_help();
+      printf ("Error serial_open()\n");
+      exit(EXIT_FAILURE);
+    }
+
+    /* 8N1 - 8 bits, no parity, 1 stop bit */
+    serial_setup(fd, UART_BAUDRATE, 8, PARITY_NONE, 1);
+    if ((link_mode == LINK_RECORD) && !journal_open(&journal, journal_file)){
+      exit(EXIT_FAILURE);
+    }
+  }
+  atexit(close_journal);
+
+  if ((convopt.limit_file != NULL) && (convopt.limit.n == 0)){
+    get_limits(fd, buf, &convopt);
+    printf ("Limit masks: %zu samples\n", convopt.limit.n);
+    convopt.limit.log_file = limit_log;
+  }
 
   switch (mode) {
      case SCREENSHOT:
        //listen and wait until the plot button is pressed
        get_plotdata (fd, buf, &count, 2.2, 120.0);
-       hexdump(buf, count);
+       if (dump){
+         hexdump(buf, count);
+       }
        save_disc(out_file, buf, count);
      break;
      case GETFILE:
@@ -520,24 +936,49 @@ int main(int argc, char *argv[])
          i++;
          send_cmd(fd,cmd_buf,i);
          usleep(delay);
-         const char cmd_exec[] = "TRAN:FILE:EXEC?";
-         strncpy(cmd_buf, cmd_exec, strlen(cmd_exec));
-         send_cmd(fd,cmd_buf,strlen(cmd_exec));
-         //usleep(delay);
-         get_trackdata (fd, buf, &count, 2.2);
-         hexdump(buf, count);
-         convert_and_save_disc(out_file, buf, count);
+         //repeated captures are numbered, -r 0 repeats until <ESC> is pressed
+         for (unsigned long capture = 1; (repeat == 0) || (capture <= repeat); capture++){
+           const char cmd_exec[] = "TRAN:FILE:EXEC?";
+           strncpy(cmd_buf, cmd_exec, strlen(cmd_exec));
+           send_cmd(fd,cmd_buf,strlen(cmd_exec));
+           //usleep(delay);
+           const bool complete = get_trackdata (fd, buf, &count, 2.2);
+           if (count == 0){
+             printf ("No data received\n");
+             break;
+           }
+           if (dump){
+             hexdump(buf, count);
+           }
+           if (repeat == 1){
+             convert_and_save_disc(out_file, buf, count, &convopt);
+           }else{
+             char capture_file[256], number[16];
+             snprintf(number, sizeof(number), "_%04lu.dat", capture);
+             famos_exchange_ext(capture_file, sizeof(capture_file), (out_file != NULL) ? out_file : "log.dat", number);
+             convert_and_save_disc(capture_file, buf, count, &convopt);
+           }
+           finish_conversions(&convopt);
+           if (!complete){
+             break;
+           }
+         }
        }
        else{
          printf ("To download a file you have to specify a runnumber a tracename\n");
        };
      break;
+     case SEQUENCE:
+       get_sequences(fd, sequences, num_sequences, out_file, &convopt);
+     break;
      default:
          print_help();
          printf ("Fall through - no mode\n");
          exit(EXIT_FAILURE);
   }
-  close (fd);
+  if (fd >= 0){
+    close (fd);
+  }
   exit(EXIT_SUCCESS);
 }
 
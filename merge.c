@@ -0,0 +1,379 @@
+/** \file merge.c
+ * \brief Merge of several traces onto a common time grid
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup merge Multi channel merge
+ *
+ * Grid point k lies at the fractional sample index pos0 + k*pstep of a
+ * channel. Every channel is resampled for a block of grid points by a
+ * branch free kernel, the rows are then written out block by block.
+ *
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "merge.h"
+#include "sink.h"
+
+
+/** Tolerance in samples when comparing positions on the sample grid */
+#define GRID_EPS 1e-6
+
+/** Half width of the windowed sinc (Lanczos) kernel in samples */
+#define SINC_HALF 4
+
+/** Samples read around the positions of a block on either side */
+#define WINDOW_MARGIN (SINC_HALF + 1)
+
+/** Decoded samples kept per channel */
+#define WINDOW_SIZE (SINK_BLOCK + 2*WINDOW_MARGIN + 2)
+
+
+static const char * const method_names[] = { "nearest", "linear", "sinc" };
+
+
+/* documented in merge.h */
+bool merge_parse_opt(merge_opt_t *opt, const char *str)
+{
+  const size_t len = strcspn(str, ",");
+
+  opt->step = 0.0;
+  for (size_t i = 0; i < sizeof(method_names)/sizeof(method_names[0]); i++) {
+    if ((strlen(method_names[i]) == len) && (strncmp(str, method_names[i], len) == 0)) {
+      opt->method = (merge_method_t)i;
+      if (str[len] == '\0') {
+        return true;
+      }
+      char *end;
+      opt->step = strtod(str + len + 1, &end);
+      return (*end == '\0') && (opt->step > 0.0);
+    }
+  }
+  return false;
+}
+
+
+/** Time of the first and the last sample of a trace */
+static void time_span(const trace_data_t *td, double *first, double *last)
+{
+  *first = famos_time(&td->header, 0);
+  *last = famos_time(&td->header, td->n - 1);
+}
+
+
+/* documented in merge.h */
+bool merge_init(merge_t *m, trace_data_t *traces, const size_t num, const merge_opt_t *opt)
+{
+  memset(m, 0, sizeof(*m));
+  m->traces = traces;
+  m->num = num;
+  m->opt = *opt;
+  if (num == 0) {
+    return false;
+  }
+
+  /* common span and the channel with the finest sample rate */
+  double start, end;
+  size_t ref = 0;
+  time_span(&traces[0], &start, &end);
+  for (size_t c = 1; c < num; c++) {
+    double first, last;
+    time_span(&traces[c], &first, &last);
+    start = (first > start) ? first : start;
+    end = (last < end) ? last : end;
+    if (traces[c].header.sample_rate < traces[ref].header.sample_rate) {
+      ref = c;
+    }
+  }
+  if (end < start) {
+    return false;
+  }
+
+  double step = opt->step, t0 = start;
+  if (step <= 0.0) {
+    /* first sample of the reference channel inside the span */
+    const famos_trace_t *h = &traces[ref].header;
+    step = h->sample_rate;
+    t0 = famos_time(h, (size_t)ceil(trace_index(h, start) - GRID_EPS));
+    if (t0 > end + GRID_EPS*step) {
+      /* the overlap is shorter than one reference sample */
+      return false;
+    }
+  }
+
+  m->header = traces[ref].header;
+  m->header.samples = NULL;
+  m->header.has_xaxis = true;
+  m->header.sample_rate = step;
+  m->header.trigger_delay = 0.0 - t0;
+  m->header.num_samples = (size_t)floor((end - t0)/step + GRID_EPS) + 1;
+  /* the channels have their own volts/div */
+  m->header.has_yaxis = false;
+
+  m->pos0 = malloc(num*sizeof(double));
+  m->pstep = malloc(num*sizeof(double));
+  m->window = malloc(num*WINDOW_SIZE*sizeof(double));
+  m->window_first = calloc(num, sizeof(size_t));
+  m->window_n = calloc(num, sizeof(size_t));
+  if ((m->pos0 == NULL) || (m->pstep == NULL) || (m->window == NULL) ||
+      (m->window_first == NULL) || (m->window_n == NULL)) {
+    printf("merge: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t c = 0; c < num; c++) {
+    m->pos0[c] = trace_index(&traces[c].header, t0);
+    m->pstep[c] = step/traces[c].header.sample_rate;
+  }
+  return true;
+}
+
+
+/** Position pos0 + i*step clamped to [0, nv-1] */
+static inline double grid_pos(const double pos0, const double step, const size_t i, const size_t nv)
+{
+  const double pos = pos0 + (double)i*step;
+  const double hi = (double)(nv - 1);
+  return (pos < 0.0) ? 0.0 : ((pos > hi) ? hi : pos);
+}
+
+
+static void kernel_nearest(const double * restrict v, const size_t nv, const double pos0,
+                           const double step, double * restrict out, const size_t n)
+{
+  for (size_t i = 0; i < n; i++) {
+    out[i] = v[(size_t)(grid_pos(pos0, step, i, nv) + 0.5)];
+  }
+}
+
+
+static void kernel_linear(const double * restrict v, const size_t nv, const double pos0,
+                          const double step, double * restrict out, const size_t n)
+{
+  for (size_t i = 0; i < n; i++) {
+    const double pos = grid_pos(pos0, step, i, nv);
+    size_t j = (size_t)pos;
+    j = (j + 1 < nv) ? j : nv - 2;
+    const double f = pos - (double)j;
+    out[i] = v[j] + f*(v[j + 1] - v[j]);
+  }
+}
+
+
+/** Lanczos kernel with 2*SINC_HALF taps, normalised to unit DC gain.
+ *  sin(pi*(f-k)) = (-1)^k sin(pi*f), hence one sine per tap is left. */
+static void kernel_sinc(const double * restrict v, const size_t nv, const double pos0,
+                        const double step, double * restrict out, const size_t n)
+{
+  for (size_t i = 0; i < n; i++) {
+    const double pos = grid_pos(pos0, step, i, nv);
+    const long j = (long)pos;
+    const double f = pos - (double)j;
+    if (f < GRID_EPS) {
+      out[i] = v[j];
+      continue;
+    }
+    const double sf = sin(M_PI*f);
+    double sum = 0.0, wsum = 0.0;
+    for (long k = 1 - SINC_HALF; k <= SINC_HALF; k++) {
+      long idx = j + k;
+      idx = (idx < 0) ? 0 : ((idx > (long)nv - 1) ? (long)nv - 1 : idx);
+      const double x = f - (double)k;
+      const double s = ((k & 1) ? -sf : sf)/(M_PI*x);
+      const double w = s*sin(M_PI*x/SINC_HALF)/(M_PI*x/SINC_HALF);
+      sum += w*v[idx];
+      wsum += w;
+    }
+    out[i] = sum/wsum;
+  }
+}
+
+
+/** Decoded samples [lo, hi) of channel c, hi - lo <= WINDOW_SIZE.
+ *
+ * The blocks move forward on the channels, hence the samples already
+ * decoded for the previous block are kept and only the new ones are
+ * fetched.
+ */
+static const double *channel_window(merge_t *m, const size_t c, const size_t lo, const size_t hi)
+{
+  double *w = m->window + c*WINDOW_SIZE;
+  const size_t wlo = m->window_first[c];
+  const size_t whi = wlo + m->window_n[c];
+
+  if ((lo >= wlo) && (hi <= whi)) {
+    return w + (lo - wlo);
+  }
+  size_t keep = 0;
+  if ((lo >= wlo) && (lo < whi)) {
+    keep = whi - lo;
+    memmove(w, w + (lo - wlo), keep*sizeof(double));
+  }
+  trace_fetch(&m->traces[c], lo + keep, hi - lo - keep, w + keep);
+  m->window_first[c] = lo;
+  m->window_n[c] = hi - lo;
+  return w;
+}
+
+
+/* documented in merge.h */
+void merge_resample(merge_t *m, const size_t c, const size_t first, const size_t n,
+                    double *out)
+{
+  const size_t nv = m->traces[c].n;
+  const double step = m->pstep[c];
+
+  if (nv < 2) {
+    const double v = channel_window(m, c, 0, 1)[0];
+    for (size_t i = 0; i < n; i++) {
+      out[i] = v;
+    }
+    return;
+  }
+  /* split the block so that the samples it reads fit into the window */
+  const double span = (double)(WINDOW_SIZE - 2*WINDOW_MARGIN - 2);
+  size_t chunk = (step > 1.0) ? (size_t)(span/step) : (size_t)span;
+  chunk = (chunk > 0) ? chunk : 1;
+  for (size_t i = 0; i < n; i += chunk) {
+    const size_t k = (n - i < chunk) ? n - i : chunk;
+    const double pos0 = m->pos0[c] + (double)(first + i)*step;
+    const double lo = floor(pos0) - WINDOW_MARGIN;
+    const double hi = ceil(pos0 + (double)(k - 1)*step) + WINDOW_MARGIN + 1;
+    const size_t wlo = (lo > 0.0) ? (size_t)lo : 0;
+    const size_t whi = (hi < (double)nv) ? (size_t)hi : nv;
+    const double *v = channel_window(m, c, wlo, whi);
+    /* the window covers every sample read, the kernels clamp to its edges
+     * only where these are the edges of the channel */
+    if (m->opt.method == MERGE_NEAREST) {
+      kernel_nearest(v, whi - wlo, pos0 - (double)wlo, step, out + i, k);
+    } else if (m->opt.method == MERGE_LINEAR) {
+      kernel_linear(v, whi - wlo, pos0 - (double)wlo, step, out + i, k);
+    } else {
+      kernel_sinc(v, whi - wlo, pos0 - (double)wlo, step, out + i, k);
+    }
+  }
+}
+
+
+/** Open an output with a large buffer, returns NULL for file NULL */
+static FILE *open_output(const char *file, const char *mode)
+{
+  if (file == NULL) {
+    return NULL;
+  }
+  FILE *fd = fopen(file, mode);
+  if (fd == NULL) {
+    printf("cannot write %s\n", file);
+    exit(EXIT_FAILURE);
+  }
+  setvbuf(fd, NULL, _IOFBF, 256*1024);
+  return fd;
+}
+
+
+/* documented in merge.h */
+bool merge_save(merge_t *m, const char *csvfile, const char *binfile,
+                char * const *names)
+{
+  const size_t cols = m->num + 1;
+  double *col = malloc(cols*SINK_BLOCK*sizeof(double));
+  double *row = malloc(cols*SINK_BLOCK*sizeof(double));
+  if ((col == NULL) || (row == NULL)) {
+    printf("merge: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  FILE *csv = open_output(csvfile, "w");
+  FILE *bin = open_output(binfile, "wb");
+
+  if (csv != NULL) {
+    famos_write_csv_header(csv, &m->header);
+    fprintf(csv, "#Resampling:        \t%s\n", method_names[m->opt.method]);
+    fprintf(csv, "#Number of Channels:\t%zu\n", m->num);
+    fprintf(csv, "#Time [s]");
+    for (size_t c = 0; c < m->num; c++) {
+      fprintf(csv, " \t %s [V]", names[c]);
+    }
+    fprintf(csv, "\n");
+  }
+
+  const size_t total = m->header.num_samples;
+  for (size_t first = 0; first < total; first += SINK_BLOCK) {
+    const size_t n = (total - first < SINK_BLOCK) ? total - first : SINK_BLOCK;
+    for (size_t i = 0; i < n; i++) {
+      col[i] = famos_time(&m->header, first + i);
+    }
+    for (size_t c = 0; c < m->num; c++) {
+      merge_resample(m, c, first, n, col + (c + 1)*SINK_BLOCK);
+    }
+    if (csv != NULL) {
+      for (size_t i = 0; i < n; i++) {
+        fprintf(csv, "%.7e", col[i]);
+        for (size_t c = 1; c < cols; c++) {
+          fprintf(csv, " \t %.7e", col[c*SINK_BLOCK + i]);
+        }
+        fprintf(csv, "\n");
+      }
+    }
+    if (bin != NULL) {
+      for (size_t i = 0; i < n; i++) {
+        for (size_t c = 0; c < cols; c++) {
+          row[i*cols + c] = col[c*SINK_BLOCK + i];
+        }
+      }
+      fwrite(row, sizeof(double), n*cols, bin);
+    }
+  }
+
+  bool ok = true;
+  if (csv != NULL) {
+    ok = (fclose(csv) == 0) && ok;
+  }
+  if (bin != NULL) {
+    ok = (fclose(bin) == 0) && ok;
+  }
+  free(col);
+  free(row);
+  return ok;
+}
+
+
+/* documented in merge.h */
+void merge_free(merge_t *m)
+{
+  free(m->pos0);
+  free(m->pstep);
+  free(m->window);
+  free(m->window_first);
+  free(m->window_n);
+  memset(m, 0, sizeof(*m));
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
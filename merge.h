@@ -0,0 +1,122 @@
+/** \file merge.h
+ * \brief Merge of several traces onto a common time grid interface
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup merge
+ * @{
+ */
+
+#ifndef MERGE_H
+#define MERGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "famos.h"
+#include "trace.h"
+
+
+/** Resampling of the channels onto the grid */
+typedef enum {
+  MERGE_NEAREST,
+  MERGE_LINEAR,
+  MERGE_SINC
+} merge_method_t;
+
+
+/** Merge settings (see merge_parse_opt()) */
+typedef struct {
+  merge_method_t method;
+  /** grid step in seconds, 0 for the finest sample rate of the channels */
+  double step;
+} merge_opt_t;
+
+
+/** Channels aligned on a common grid */
+typedef struct {
+  /** channels opened with trace_open() */
+  trace_data_t *traces;
+  size_t num;
+  merge_opt_t opt;
+  /** grid: t = famos_time(&header, k) for k < header.num_samples */
+  famos_trace_t header;
+  /** fractional sample index of channel c at grid point k: pos0[c] + k*pstep[c] */
+  double *pos0;
+  double *pstep;
+  /** per channel the decoded samples [window_first, window_first+window_n) */
+  double *window;
+  size_t *window_first;
+  size_t *window_n;
+} merge_t;
+
+
+/** Parse "method[,step]" with method nearest, linear or sinc */
+bool merge_parse_opt(merge_opt_t *opt, const char *str);
+
+
+/** Build the grid over the time span common to all channels.
+ *
+ * The grid is aligned to the samples of the (first) channel with the
+ * finest sample rate unless a step is given.
+ *
+ * \return false if no grid point lies in the time span of all channels
+ */
+bool merge_init(merge_t *m, trace_data_t *traces, const size_t num, const merge_opt_t *opt);
+
+
+/** Resample channel c at the grid points [first, first+n) into out.
+ *
+ * Only the samples around the grid points are decoded, the blocks
+ * should be requested in ascending order.
+ */
+void merge_resample(merge_t *m, const size_t c, const size_t first, const size_t n,
+                    double *out);
+
+
+/** Write the time column and one column per channel, the rows are
+ *  produced in blocks and never held as a whole.
+ *
+ * Only the decoding is bounded: trace_open() keeps the content of every
+ * input file in memory, so the memory use grows with the size of the
+ * track files (raw files hold one byte, CSV files some 30 bytes per
+ * sample).
+ *
+ * \param csvfile CSV output or NULL
+ * \param binfile rows of native doubles or NULL
+ * \param names   column names (file names of the channels)
+ */
+bool merge_save(merge_t *m, const char *csvfile, const char *binfile,
+                char * const *names);
+
+
+/** Release the memory of a merge */
+void merge_free(merge_t *m);
+
+
+/** @} */
+
+#endif /* !MERGE_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -85,52 +85,16 @@ SWITCH: {
 syswrite(GP, "quit\n");
 
 
-#subroutine parses two files and writes the data difference to ./tmp.dat
+#subroutine aligns two traces on their time axes and writes the difference to ./tmp.csv
 sub parse_and_difference_to_tmp
 {
   my $plotfile1 = $_[0];
   my $plotfile2 = $_[1];
 
   print "Print difference from arg[1] & arg[2]: $plotfile1 - $plotfile2 \n";
-  #parse first histogram
-  open (FILE1, "<$plotfile1") ||
-    die "cannot open $plotfile1 ";
-  LINE1: while (<FILE1>) {
-    chomp;
-    # if the line starts with "#" (the anchor ^ means match
-    # at the beginning of the string)
-    next LINE1 if ($_ =~ /^#/);
-    # numbers have to be separated by a tab
-    my @data = split(/\t/,$_);
-    $matrix1[$data[0]] = $data[1];
-  }
-  #  a weaker solution would be:
-  #     if (!($_ =~ /\s*#.*/)){
-  #        $_ =~ /\s*([0-9]+)\s+([0-9]+)/;
-  #        $matrix2[$1]=$2;
-  close (FILE1) ||
-    die "cannot close $plotfile1 ";
-  #parse second histogram
-  open (FILE2, "<$plotfile2") ||
-    die "cannot open  $plotfile2 ";
-  LINE2: while (<FILE2>) {
-    chomp;
-    # the anchor ^ means match at the beginning of the string with '#'
-    next LINE2 if ($_ =~ /^#/);
-    # separate numbers between a tab
-    my @data = split(/\t/,$_);
-    $matrix2[$data[0]] = $data[1];
-  }
-  close (FILE2) ||
-    die "cannot close $plotfile2 ";
-  #take both arrays and write difference into ./tmp.dat
-  open (TMP, ">$tmpfile") ||
-    die "cannot open  $tmpfile ";
-  for ($i = 0;$i < @matrix1;$i++){
-    $delta = $matrix1[$i] - $matrix2[$i];
-    print TMP "$i $delta \n";
-  }
-  close (TMP) ||
-    die "cannot close $tmpfile ";
-  return $tmpfile;
+  # dso_serial reads raw track files (.dat) as well as converted csv files
+  # and interpolates the background if the sample grids differ
+  system("./dso_serial", "-D", $plotfile2, "-o", $tmpfile, $plotfile1) == 0 ||
+    die "cannot calculate difference of $plotfile1 and $plotfile2 ";
+  return "$datadir/tmp.csv";
 }
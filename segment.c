@@ -0,0 +1,159 @@
+/** \file segment.c
+ * \brief Parallel conversion of downloaded sequence segments
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup segment Sequence segments
+ *
+ * The serial link delivers the sequences one after the other. As soon
+ * as a segment is complete it is handed to a worker thread which parses
+ * and converts it while the main thread already receives the next one.
+ * Every worker owns its buffer and output files, shared state (the
+ * catalogue, the average) is updated by the caller after the join.
+ *
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "segment.h"
+
+
+/* documented in segment.h */
+size_t segment_parse_list(const char *str, int *numbers)
+{
+  bool used[SEGMENT_MAX + 1] = { false };
+  size_t n = 0;
+
+  while (*str != '\0') {
+    char *end;
+    const long first = strtol(str, &end, 10);
+    long last = first;
+    if (end == str) {
+      return 0;
+    }
+    str = end;
+    if (*str == '-') {
+      str++;
+      last = strtol(str, &end, 10);
+      if (end == str) {
+        return 0;
+      }
+      str = end;
+    }
+    if ((first < 1) || (last > SEGMENT_MAX) || (last < first)) {
+      return 0;
+    }
+    for (long k = first; k <= last; k++) {
+      if (!used[k]) {
+        used[k] = true;
+        numbers[n++] = (int)k;
+      }
+    }
+    if (*str == ',') {
+      str++;
+    } else if (*str != '\0') {
+      return 0;
+    }
+  }
+  return n;
+}
+
+
+/** Worker: parse the segment and feed the output sinks */
+static void *segment_worker(void *arg)
+{
+  segment_t *seg = arg;
+  sink_t sinks[SINK_MAX];
+
+  famos_parse(seg->buf, seg->count, &seg->trace);
+  if (seg->trace.samples == NULL) {
+    printf("Note: no datapoints found in sequence %d\n", seg->number);
+  }
+  sink_source_t src;
+  memset(&src, 0, sizeof(src));
+  src.file = seg->file;
+  src.raw = seg->buf;
+  src.raw_count = seg->count;
+  src.trace = &seg->trace;
+  src.num_samples = seg->trace.num_samples;
+  seg->ok = sink_run(sinks, sink_select(sinks, &seg->outputs), &src);
+  printf("Sequence %d: %zu samples converted\n", seg->number, seg->trace.num_samples);
+  return NULL;
+}
+
+
+/* documented in segment.h */
+bool segment_start(segment_t *seg)
+{
+  seg->outputs.raw = true;
+  seg->ok = false;
+  seg->started = (pthread_create(&seg->thread, NULL, segment_worker, seg) == 0);
+  if (!seg->started) {
+    printf("cannot start a worker for sequence %d - converting it now\n", seg->number);
+    segment_worker(seg);
+  }
+  return seg->started;
+}
+
+
+/* documented in segment.h */
+bool segment_join(segment_t *seg)
+{
+  if (!seg->started) {
+    return seg->ok;
+  }
+  pthread_join(seg->thread, NULL);
+  seg->started = false;
+  return seg->ok;
+}
+
+
+/* documented in segment.h */
+bool segment_write_index(const segment_t *segs, const size_t num, const char *file)
+{
+  FILE *fd = fopen(file, "w");
+  if (fd == NULL) {
+    return false;
+  }
+  fprintf(fd, "#Sequence \t File \t Bytes \t Samples \t Samplerate [s] \t Trigger delay [s] \t"
+              " Mesial voltage [V] \t Offset [V] \t Date \t Time \t Status\n");
+  for (size_t i = 0; i < num; i++) {
+    const segment_t *s = &segs[i];
+    const famos_trace_t *t = &s->trace;
+    fprintf(fd, "%d \t %s \t %zu \t %zu \t %.7e \t %.7e \t %.7e \t %.7e \t %s \t %s \t %s\n",
+            s->number, s->file, s->count, t->num_samples, t->sample_rate, t->trigger_delay,
+            t->mesial_voltage, t->offset_voltage,
+            (t->date[0] != '\0') ? t->date : "-", (t->time[0] != '\0') ? t->time : "-",
+            s->incomplete ? "incomplete" : ((t->samples == NULL) ? "empty" : (s->ok ? "ok" : "failed")));
+  }
+  return (fclose(fd) == 0);
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,99 @@
+/** \file segment.h
+ * \brief Parallel conversion of downloaded sequence segments interface
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup segment
+ * @{
+ */
+
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "famos.h"
+#include "sink.h"
+
+
+/** Number of acquisition sequences of the DSO (:TRANsfer:SEQuence[12345678]) */
+#define SEGMENT_MAX 8
+
+
+/** One downloaded sequence and its conversion */
+typedef struct {
+  /** sequence number 1..8 */
+  int number;
+  /** track file of the segment, the outputs are named after it */
+  char file[256];
+  /** received track file */
+  char *buf;
+  size_t count;
+  /** header of the segment (valid after segment_join()) */
+  famos_trace_t trace;
+  /** outputs of the conversion, raw is always written */
+  sink_opt_t outputs;
+  /** the transfer was cancelled, the segment is not converted */
+  bool incomplete;
+  /** a worker thread converts the segment */
+  bool started;
+  bool ok;
+  pthread_t thread;
+} segment_t;
+
+
+/** Parse a list of sequence numbers, e.g. "1-8" or "1,3,5-6".
+ *
+ * \param numbers array of #SEGMENT_MAX entries
+ * \return number of sequences or 0 for an invalid list
+ */
+size_t segment_parse_list(const char *str, int *numbers);
+
+
+/** Convert a received segment on a worker thread.
+ *
+ * seg->buf must stay valid until segment_join(), the worker only writes
+ * the files of its own segment. If no thread can be started the segment
+ * is converted on the calling thread before returning.
+ *
+ * \return false if the segment was converted on the calling thread
+ */
+bool segment_start(segment_t *seg);
+
+
+/** Wait for the conversion of a segment, returns its result */
+bool segment_join(segment_t *seg);
+
+
+/** Write the index of all segments (number, file, bytes, samples, setup) as CSV */
+bool segment_write_index(const segment_t *segs, const size_t num, const char *file);
+
+
+/** @} */
+
+#endif /* !SEGMENT_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,528 @@
+/** \file sink.c
+ * \brief Output sinks fed from a single pass over the decoded samples
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup sink Output sinks
+ *
+ * The samples of a trace are decoded once per block of #SINK_BLOCK
+ * samples into time and voltage arrays, every registered sink formats
+ * the same block. Adding an output therefore only adds its own
+ * formatting time.
+ *
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "sink.h"
+
+
+/** Output file buffer size */
+#define SINK_FILE_BUF (256*1024)
+
+
+static void *xmalloc(const size_t size)
+{
+  void *p = malloc(size);
+  if (p == NULL) {
+    printf("sink: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+
+/** Open an output named after the track file with the extension ext */
+static FILE *sink_fopen(const sink_source_t *src, const char *ext, const char *what)
+{
+  char fileexp[256];
+  famos_exchange_ext(fileexp, sizeof(fileexp), src->file, ext);
+  printf("Exporting %s: %s\n", what, fileexp);
+  FILE *fd = fopen(fileexp, "w");
+  if (fd == NULL) {
+    printf("cannot write %s\n", fileexp);
+    return NULL;
+  }
+  setvbuf(fd, NULL, _IOFBF, SINK_FILE_BUF);
+  return fd;
+}
+
+
+/* ---- raw copy of the track file ---- */
+
+static bool raw_open(sink_t *sink, const sink_source_t *src)
+{
+  (void)sink;
+  if (src->raw == NULL) {
+    return true;
+  }
+  FILE *fd = fopen(src->file, "w");
+  if (fd == NULL) {
+    printf("cannot write %s\n", src->file);
+    return false;
+  }
+  const size_t written = fwrite(src->raw, 1, src->raw_count, fd);
+  if ((fclose(fd) != 0) || (written != src->raw_count)) {
+    printf("cannot write %s\n", src->file);
+    return false;
+  }
+  printf("%zd bytes written\n", src->raw_count);
+  return true;
+}
+
+
+/* ---- CSV ---- */
+
+static bool csv_open(sink_t *sink, const sink_source_t *src)
+{
+  FILE *fd = sink_fopen(src, ".csv", "FAMOS track file to CSV");
+  if (fd == NULL) {
+    return false;
+  }
+  famos_write_csv_header(fd, src->trace);
+  sink->state = fd;
+  return true;
+}
+
+
+static void csv_write(sink_t *sink, const sink_block_t *blk)
+{
+  FILE *fd = sink->state;
+  for (size_t i = 0; i < blk->n; i++) {
+    fprintf(fd, "%.7e \t %.7e\n", blk->t[i], blk->v[i]);
+  }
+}
+
+
+/** Shared close of the sinks whose state is the output file */
+static bool file_close(sink_t *sink, const sink_source_t *src)
+{
+  (void)src;
+  return (fclose((FILE *)sink->state) == 0);
+}
+
+
+/* ---- binary time/voltage pairs ---- */
+
+static bool bin_open(sink_t *sink, const sink_source_t *src)
+{
+  FILE *fd = sink_fopen(src, ".bin", "binary time/voltage columns");
+  sink->state = fd;
+  return (fd != NULL);
+}
+
+
+static void bin_write(sink_t *sink, const sink_block_t *blk)
+{
+  double row[2*SINK_BLOCK];
+  for (size_t i = 0; i < blk->n; i++) {
+    row[2*i] = blk->t[i];
+    row[2*i + 1] = blk->v[i];
+  }
+  fwrite(row, sizeof(double), 2*blk->n, (FILE *)sink->state);
+}
+
+
+/* ---- min/max envelope ---- */
+
+typedef struct {
+  FILE *fd;
+  size_t decimation;
+  size_t fill;
+  double t0;
+  double vmin;
+  double vmax;
+} env_state_t;
+
+
+static bool env_open(sink_t *sink, const sink_source_t *src)
+{
+  env_state_t *env = xmalloc(sizeof(env_state_t));
+  memset(env, 0, sizeof(*env));
+  env->decimation = (sink->opt->env_decimation > 0) ? sink->opt->env_decimation : 1;
+  env->fd = sink_fopen(src, "_env.csv", "min/max envelope");
+  if (env->fd == NULL) {
+    free(env);
+    return false;
+  }
+  sink->state = env;
+  famos_write_csv_header(env->fd, src->trace);
+  fprintf(env->fd, "#Envelope decimation:\t%zu\n", env->decimation);
+  fprintf(env->fd, "#Time [s] \t Minimum [V] \t Maximum [V]\n");
+  return true;
+}
+
+
+static void env_write(sink_t *sink, const sink_block_t *blk)
+{
+  env_state_t *env = sink->state;
+  for (size_t i = 0; i < blk->n; i++) {
+    const double v = blk->v[i];
+    if (env->fill == 0) {
+      env->t0 = blk->t[i];
+      env->vmin = v;
+      env->vmax = v;
+    } else {
+      env->vmin = (v < env->vmin) ? v : env->vmin;
+      env->vmax = (v > env->vmax) ? v : env->vmax;
+    }
+    if (++env->fill == env->decimation) {
+      fprintf(env->fd, "%.7e \t %.7e \t %.7e\n", env->t0, env->vmin, env->vmax);
+      env->fill = 0;
+    }
+  }
+}
+
+
+static bool env_close(sink_t *sink, const sink_source_t *src)
+{
+  (void)src;
+  env_state_t *env = sink->state;
+  if (env->fill > 0) {
+    fprintf(env->fd, "%.7e \t %.7e \t %.7e\n", env->t0, env->vmin, env->vmax);
+  }
+  const bool ok = (fclose(env->fd) == 0);
+  free(env);
+  return ok;
+}
+
+
+/* ---- statistics ---- */
+
+typedef struct {
+  size_t n;
+  size_t out_of_range;
+  double sum;
+  double sum2;
+  double vmin, tmin;
+  double vmax, tmax;
+} stats_state_t;
+
+
+static bool stats_open(sink_t *sink, const sink_source_t *src)
+{
+  (void)src;
+  stats_state_t *st = xmalloc(sizeof(stats_state_t));
+  memset(st, 0, sizeof(*st));
+  st->vmin = HUGE_VAL;
+  st->vmax = -HUGE_VAL;
+  sink->state = st;
+  return true;
+}
+
+
+static void stats_write(sink_t *sink, const sink_block_t *blk)
+{
+  stats_state_t *st = sink->state;
+  double sum = 0.0, sum2 = 0.0;
+  for (size_t i = 0; i < blk->n; i++) {
+    const double v = blk->v[i];
+    sum += v;
+    sum2 += v*v;
+    if (v < st->vmin) {
+      st->vmin = v;
+      st->tmin = blk->t[i];
+    }
+    if (v > st->vmax) {
+      st->vmax = v;
+      st->tmax = blk->t[i];
+    }
+  }
+  if (blk->codes != NULL) {
+    for (size_t i = 0; i < blk->n; i++) {
+      st->out_of_range += (blk->codes[i] == 0x00);
+    }
+  }
+  st->sum += sum;
+  st->sum2 += sum2;
+  st->n += blk->n;
+}
+
+
+static bool stats_close(sink_t *sink, const sink_source_t *src)
+{
+  stats_state_t *st = sink->state;
+  FILE *fd = sink_fopen(src, "_stats.txt", "statistics");
+  if (fd == NULL) {
+    free(st);
+    return false;
+  }
+  const double n = (st->n > 0) ? (double)st->n : 1.0;
+  const double mean = st->sum/n;
+  const double var = st->sum2/n - mean*mean;
+  fprintf(fd, "#Statistics:\n");
+  fprintf(fd, "#Number of Samples: \t%zu\n", st->n);
+  if (st->n > 0) {
+    fprintf(fd, "#Minimum [V]:       \t%.7e\n", st->vmin);
+    fprintf(fd, "#Minimum at [s]:    \t%.7e\n", st->tmin);
+    fprintf(fd, "#Maximum [V]:       \t%.7e\n", st->vmax);
+    fprintf(fd, "#Maximum at [s]:    \t%.7e\n", st->tmax);
+    fprintf(fd, "#Mean [V]:          \t%.7e\n", mean);
+    fprintf(fd, "#RMS [V]:           \t%.7e\n", sqrt(st->sum2/n));
+    fprintf(fd, "#Std deviation [V]: \t%.7e\n", sqrt(var > 0.0 ? var : 0.0));
+  }
+  if (src->trace->samples != NULL) {
+    fprintf(fd, "#Out of range:      \t%zu\n", st->out_of_range);
+  }
+  free(st);
+  return (fclose(fd) == 0);
+}
+
+
+/* ---- spectrum ---- */
+
+static bool fft_open(sink_t *sink, const sink_source_t *src)
+{
+  spectrum_t *spec = xmalloc(sizeof(spectrum_t));
+  spectrum_init(spec, &sink->opt->fft_opt, src->trace->sample_rate, src->num_samples);
+  sink->state = spec;
+  return true;
+}
+
+
+static void fft_write(sink_t *sink, const sink_block_t *blk)
+{
+  spectrum_feed(sink->state, blk->v, blk->n);
+}
+
+
+static bool fft_close(sink_t *sink, const sink_source_t *src)
+{
+  spectrum_t *spec = sink->state;
+  char fileexp[256];
+
+  spectrum_finish(spec);
+  famos_exchange_ext(fileexp, sizeof(fileexp), src->file, spec->opt.binary ? "_fft.bin" : "_fft.csv");
+  printf("Exporting spectrum (%zu point FFT, %zu segments): %s\n", spec->nfft, spec->segments, fileexp);
+  const bool ok = spectrum_save(spec, fileexp);
+  if (!ok) {
+    printf("cannot write %s\n", fileexp);
+  }
+  spectrum_free(spec);
+  free(spec);
+  return ok;
+}
+
+
+/* ---- software trigger events ---- */
+
+static bool events_open(sink_t *sink, const sink_source_t *src)
+{
+  if (src->fetch != NULL) {
+    printf("Note: event search needs the sample codes, skipped for %s\n", src->file);
+    sink->state = NULL;
+    return true;
+  }
+  events_t *ev = xmalloc(sizeof(events_t));
+  events_init(ev, &sink->opt->events_opt, src->trace);
+  sink->state = ev;
+  return true;
+}
+
+
+static void events_write(sink_t *sink, const sink_block_t *blk)
+{
+  if (sink->state != NULL) {
+    events_scan(sink->state, blk->codes, blk->first, blk->n);
+  }
+}
+
+
+static bool events_close(sink_t *sink, const sink_source_t *src)
+{
+  events_t *ev = sink->state;
+  char csvfile[256], idxfile[256];
+
+  if (ev == NULL) {
+    return true;
+  }
+  events_finish(ev);
+  famos_exchange_ext(csvfile, sizeof(csvfile), src->file, "_events.csv");
+  famos_exchange_ext(idxfile, sizeof(idxfile), src->file, "_events.idx");
+  printf("Exporting %zu events: %s\n", ev->count, csvfile);
+  const bool ok = events_save(ev, csvfile, idxfile);
+  if (!ok) {
+    printf("cannot write %s\n", csvfile);
+  }
+  events_free(ev);
+  free(ev);
+  return ok;
+}
+
+
+/* documented in sink.h */
+bool sink_parse_opt(sink_opt_t *opt, const char *str)
+{
+  char item[32];
+
+  opt->raw = opt->csv = opt->bin = opt->env = opt->stats = opt->fft = false;
+  opt->events = false;
+  while (*str != '\0') {
+    const size_t len = strcspn(str, ",");
+    if ((len == 0) || (len >= sizeof(item))) {
+      return false;
+    }
+    memcpy(item, str, len);
+    item[len] = '\0';
+    str += len;
+    if (*str == ',') {
+      str++;
+    }
+    if (strcmp(item, "raw") == 0) {
+      opt->raw = true;
+    } else if (strcmp(item, "csv") == 0) {
+      opt->csv = true;
+    } else if (strcmp(item, "bin") == 0) {
+      opt->bin = true;
+    } else if (strncmp(item, "env", 3) == 0) {
+      opt->env = true;
+      opt->env_decimation = 64;
+      if (item[3] == ':') {
+        char *end;
+        opt->env_decimation = strtoul(item + 4, &end, 10);
+        if ((*end != '\0') || (opt->env_decimation == 0)) {
+          return false;
+        }
+      } else if (item[3] != '\0') {
+        return false;
+      }
+    } else if (strcmp(item, "stats") == 0) {
+      opt->stats = true;
+    } else if (strcmp(item, "fft") == 0) {
+      opt->fft = true;
+    } else if (strcmp(item, "events") == 0) {
+      opt->events = true;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+/* documented in sink.h */
+size_t sink_select(sink_t *sinks, const sink_opt_t *opt)
+{
+  size_t n = 0;
+  memset(sinks, 0, SINK_MAX*sizeof(sink_t));
+  if (opt->raw) {
+    sinks[n++] = (sink_t){ "raw", raw_open, NULL, NULL, opt, NULL, false };
+  }
+  if (opt->csv) {
+    sinks[n++] = (sink_t){ "csv", csv_open, csv_write, file_close, opt, NULL, false };
+  }
+  if (opt->bin) {
+    sinks[n++] = (sink_t){ "bin", bin_open, bin_write, file_close, opt, NULL, false };
+  }
+  if (opt->env) {
+    sinks[n++] = (sink_t){ "env", env_open, env_write, env_close, opt, NULL, false };
+  }
+  if (opt->stats) {
+    sinks[n++] = (sink_t){ "stats", stats_open, stats_write, stats_close, opt, NULL, false };
+  }
+  if (opt->fft) {
+    sinks[n++] = (sink_t){ "fft", fft_open, fft_write, fft_close, opt, NULL, false };
+  }
+  if (opt->events) {
+    sinks[n++] = (sink_t){ "events", events_open, events_write, events_close, opt, NULL, true };
+  }
+  return n;
+}
+
+
+/** Decode the 8 bit codes of a FAMOS trace */
+static void fetch_trace(const sink_source_t *src, const size_t first, const size_t n,
+                        double *t, double *v)
+{
+  const famos_trace_t *trace = src->trace;
+  for (size_t i = 0; i < n; i++) {
+    t[i] = famos_time(trace, first + i);
+    v[i] = famos_voltage(trace, trace->samples[first + i]);
+  }
+}
+
+
+/* documented in sink.h */
+bool sink_run(sink_t *sinks, const size_t num_sinks, const sink_source_t *src)
+{
+  double t[SINK_BLOCK], v[SINK_BLOCK];
+  bool ok = true;
+  size_t opened = 0;
+
+  while (ok && (opened < num_sinks)) {
+    ok = sinks[opened].open(&sinks[opened], src);
+    if (ok) {
+      opened++;
+    }
+  }
+
+  bool need_samples = false, need_values = false;
+  for (size_t s = 0; s < opened; s++) {
+    need_samples |= (sinks[s].write != NULL);
+    need_values |= (sinks[s].write != NULL) && !sinks[s].codes_only;
+  }
+  if (ok && need_samples) {
+    const bool coded = (src->fetch == NULL);
+    for (size_t first = 0; first < src->num_samples; first += SINK_BLOCK) {
+      sink_block_t blk;
+      blk.first = first;
+      blk.n = src->num_samples - first;
+      if (blk.n > SINK_BLOCK) {
+        blk.n = SINK_BLOCK;
+      }
+      blk.codes = coded ? src->trace->samples + first : NULL;
+      blk.t = need_values ? t : NULL;
+      blk.v = need_values ? v : NULL;
+      if (!need_values) {
+        /* the codes are all the sinks read */
+      } else if (coded) {
+        fetch_trace(src, first, blk.n, t, v);
+      } else {
+        src->fetch(src, first, blk.n, t, v);
+      }
+      for (size_t s = 0; s < opened; s++) {
+        if (sinks[s].write != NULL) {
+          sinks[s].write(&sinks[s], &blk);
+        }
+      }
+    }
+  }
+
+  /* close whatever has been opened, also after an error */
+  for (size_t s = 0; s < opened; s++) {
+    if (sinks[s].close != NULL) {
+      ok = sinks[s].close(&sinks[s], src) && ok;
+    }
+  }
+  return ok;
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,148 @@
+/** \file sink.h
+ * \brief Output sinks fed from a single pass over the decoded samples
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup sink
+ * @{
+ */
+
+#ifndef SINK_H
+#define SINK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "famos.h"
+#include "spectrum.h"
+#include "events.h"
+
+
+/** Number of samples decoded at once and handed to every sink.
+ *  The time, voltage and code arrays of one block stay in the L1/L2 cache. */
+#define SINK_BLOCK 2048
+
+
+/** Maximum number of sinks of one pass */
+#define SINK_MAX 12
+
+
+/** Selection of outputs (see sink_parse_opt()) */
+typedef struct {
+  /** copy of the raw track file */
+  bool raw;
+  /** time/voltage CSV (*.csv) */
+  bool csv;
+  /** time/voltage pairs as native doubles (*.bin) */
+  bool bin;
+  /** min/max envelope of every env_decimation samples (*_env.csv) */
+  bool env;
+  size_t env_decimation;
+  /** min, max, mean, rms, ... (*_stats.txt) */
+  bool stats;
+  /** spectrum (*_fft.csv or *_fft.bin) */
+  bool fft;
+  spectrum_opt_t fft_opt;
+  /** software trigger events (*_events.csv and *_events.idx) */
+  bool events;
+  events_opt_t events_opt;
+} sink_opt_t;
+
+
+/** Source of the samples for one fan-out pass */
+typedef struct sink_source {
+  /** name of the track file, the outputs are named after it */
+  const char *file;
+  /** raw track file content or NULL if the trace was computed */
+  const void *raw;
+  size_t raw_count;
+  /** header fields for the outputs */
+  const famos_trace_t *trace;
+  /** number of samples of the trace */
+  size_t num_samples;
+  /** fill t and v for the samples [first, first+n), NULL to decode trace->samples */
+  void (*fetch)(const struct sink_source *src, const size_t first, const size_t n,
+                double *t, double *v);
+  /** private data of fetch */
+  const void *ctx;
+} sink_source_t;
+
+
+/** One block of decoded samples */
+typedef struct {
+  /** sample number of the first value */
+  size_t first;
+  size_t n;
+  /** raw 8 bit codes or NULL for computed traces */
+  const uint8_t *codes;
+  /** decoded samples, NULL if every sink of the pass only reads codes */
+  const double *t;
+  const double *v;
+} sink_block_t;
+
+
+/** An output registered for a fan-out pass */
+typedef struct sink {
+  const char *name;
+  bool (*open)(struct sink *sink, const sink_source_t *src);
+  void (*write)(struct sink *sink, const sink_block_t *blk);
+  bool (*close)(struct sink *sink, const sink_source_t *src);
+  const sink_opt_t *opt;
+  void *state;
+  /** write only reads blk->codes, the samples need not be decoded */
+  bool codes_only;
+} sink_t;
+
+
+/** Parse a comma separated output list, e.g. "raw,csv,bin,env:64,stats,fft,events".
+ *
+ * Entries not in the list are switched off, the fft and event settings are kept.
+ */
+bool sink_parse_opt(sink_opt_t *opt, const char *str);
+
+
+/** Register the outputs selected in opt.
+ *
+ * \param sinks array of at least #SINK_MAX entries
+ * \return number of registered sinks
+ */
+size_t sink_select(sink_t *sinks, const sink_opt_t *opt);
+
+
+/** Feed all sinks from one walk over the samples of src in blocks of #SINK_BLOCK.
+ *
+ * The samples are only decoded to time and voltage if a sink without
+ * codes_only is fed.
+ *
+ * \return false if an output could not be written
+ */
+bool sink_run(sink_t *sinks, const size_t num_sinks, const sink_source_t *src);
+
+
+/** @} */
+
+#endif /* !SINK_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
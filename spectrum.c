@@ -0,0 +1,454 @@
+/** \file spectrum.c
+ * \brief Spectrum analysis (real FFT, windowing, Welch averaging)
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup spectrum Spectrum analysis
+ *
+ * A real sequence of length n is packed into a complex sequence of
+ * length n/2 which is transformed by a self sorting (Stockham) mixed
+ * radix FFT with radix 4, 2, 3 and 5 stages. The n/2+1 bins of the real
+ * spectrum are unpacked from the result afterwards.
+ *
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+#include "spectrum.h"
+
+
+#define MAX_FACTORS 64
+
+
+struct rfft_plan {
+  /** real length */
+  size_t n;
+  /** complex length n/2 */
+  size_t m;
+  size_t nfactors;
+  size_t factors[MAX_FACTORS];
+  /** exp(-2 pi i k/m), k < m */
+  spectrum_complex_t *tw;
+  /** exp(-2 pi i k/n), k <= m, for unpacking the real spectrum */
+  spectrum_complex_t *rtw;
+  spectrum_complex_t *buf0;
+  spectrum_complex_t *buf1;
+};
+
+
+static const char *window_names[] = { "rect", "hann", "hamming", "blackman", "flattop" };
+
+
+static void *xmalloc(const size_t size)
+{
+  void *p = malloc(size > 0 ? size : 1);
+  if (p == NULL) {
+    printf("spectrum: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+
+static inline spectrum_complex_t cmul(const spectrum_complex_t a, const spectrum_complex_t b)
+{
+  spectrum_complex_t c = { a.re*b.re - a.im*b.im, a.re*b.im + a.im*b.re };
+  return c;
+}
+
+
+/* documented in spectrum.h */
+size_t rfft_fast_size(const size_t n)
+{
+  size_t m = (n + 1)/2;
+  if (m < 1) {
+    m = 1;
+  }
+  for (;; m++) {
+    size_t r = m;
+    while (r % 2 == 0) r /= 2;
+    while (r % 3 == 0) r /= 3;
+    while (r % 5 == 0) r /= 5;
+    if (r == 1) {
+      return 2*m;
+    }
+  }
+}
+
+
+/* documented in spectrum.h */
+rfft_plan_t *rfft_plan_create(const size_t n)
+{
+  rfft_plan_t *plan = xmalloc(sizeof(rfft_plan_t));
+  plan->n = n;
+  plan->m = n/2;
+  plan->nfactors = 0;
+  size_t r = plan->m;
+  static const size_t radix[] = { 4, 2, 3, 5 };
+  for (size_t i = 0; i < sizeof(radix)/sizeof(radix[0]); i++) {
+    while ((r % radix[i] == 0) && (plan->nfactors < MAX_FACTORS)) {
+      plan->factors[plan->nfactors++] = radix[i];
+      r /= radix[i];
+    }
+  }
+  if (r != 1) {
+    printf("spectrum: unsupported FFT length %zu\n", n);
+    exit(EXIT_FAILURE);
+  }
+  plan->tw = xmalloc(plan->m*sizeof(spectrum_complex_t));
+  plan->rtw = xmalloc((plan->m + 1)*sizeof(spectrum_complex_t));
+  plan->buf0 = xmalloc(plan->m*sizeof(spectrum_complex_t));
+  plan->buf1 = xmalloc(plan->m*sizeof(spectrum_complex_t));
+  for (size_t k = 0; k < plan->m; k++) {
+    const double a = -2.0*M_PI*(double)k/(double)plan->m;
+    plan->tw[k].re = cos(a);
+    plan->tw[k].im = sin(a);
+  }
+  for (size_t k = 0; k <= plan->m; k++) {
+    const double a = -2.0*M_PI*(double)k/(double)plan->n;
+    plan->rtw[k].re = cos(a);
+    plan->rtw[k].im = sin(a);
+  }
+  return plan;
+}
+
+
+/* documented in spectrum.h */
+void rfft_plan_free(rfft_plan_t *plan)
+{
+  if (plan == NULL) {
+    return;
+  }
+  free(plan->tw);
+  free(plan->rtw);
+  free(plan->buf0);
+  free(plan->buf1);
+  free(plan);
+}
+
+
+/** One Stockham stage of radix R: src -> dst, Ns = product of the previous radices */
+static void fft_stage(const rfft_plan_t *plan, const size_t R, const size_t Ns,
+                      const spectrum_complex_t *src, spectrum_complex_t *dst)
+{
+  const size_t m = plan->m;
+  const size_t stride = m/R;
+  const size_t twstep = m/(Ns*R);
+  const spectrum_complex_t *tw = plan->tw;
+  spectrum_complex_t v[5], y[5];
+
+  for (size_t b = 0; b < stride/Ns; b++) {
+    for (size_t k = 0; k < Ns; k++) {
+      const size_t j = b*Ns + k;
+      v[0] = src[j];
+      for (size_t r = 1; r < R; r++) {
+        v[r] = cmul(src[j + r*stride], tw[r*k*twstep]);
+      }
+      spectrum_complex_t *d = &dst[b*Ns*R + k];
+      switch (R) {
+        case 2:
+          d[0].re = v[0].re + v[1].re; d[0].im = v[0].im + v[1].im;
+          d[Ns].re = v[0].re - v[1].re; d[Ns].im = v[0].im - v[1].im;
+          break;
+        case 4: {
+          const double s02re = v[0].re + v[2].re, s02im = v[0].im + v[2].im;
+          const double d02re = v[0].re - v[2].re, d02im = v[0].im - v[2].im;
+          const double s13re = v[1].re + v[3].re, s13im = v[1].im + v[3].im;
+          const double d13re = v[1].re - v[3].re, d13im = v[1].im - v[3].im;
+          d[0].re = s02re + s13re;    d[0].im = s02im + s13im;
+          d[Ns].re = d02re + d13im;   d[Ns].im = d02im - d13re;
+          d[2*Ns].re = s02re - s13re; d[2*Ns].im = s02im - s13im;
+          d[3*Ns].re = d02re - d13im; d[3*Ns].im = d02im + d13re;
+          break;
+        }
+        default:
+          /* radix 3 and 5: plain DFT with the roots of unity from the table */
+          for (size_t q = 0; q < R; q++) {
+            y[q] = v[0];
+            for (size_t r = 1; r < R; r++) {
+              const spectrum_complex_t p = cmul(v[r], tw[((q*r) % R)*stride]);
+              y[q].re += p.re;
+              y[q].im += p.im;
+            }
+          }
+          for (size_t q = 0; q < R; q++) {
+            d[q*Ns] = y[q];
+          }
+          break;
+      }
+    }
+  }
+}
+
+
+/* documented in spectrum.h */
+void rfft_execute(rfft_plan_t *plan, const double *in, spectrum_complex_t *out)
+{
+  const size_t m = plan->m;
+  spectrum_complex_t *src = plan->buf0, *dst = plan->buf1;
+
+  for (size_t k = 0; k < m; k++) {
+    src[k].re = in[2*k];
+    src[k].im = in[2*k + 1];
+  }
+  size_t Ns = 1;
+  for (size_t f = 0; f < plan->nfactors; f++) {
+    fft_stage(plan, plan->factors[f], Ns, src, dst);
+    Ns *= plan->factors[f];
+    spectrum_complex_t *t = src; src = dst; dst = t;
+  }
+
+  /* X[k] = E[k] + W_n^k O[k] with E, O the spectra of the even and odd samples */
+  for (size_t k = 0; k <= m; k++) {
+    const spectrum_complex_t zk = src[k % m];
+    const spectrum_complex_t zc = { src[(m - k) % m].re, -src[(m - k) % m].im };
+    const spectrum_complex_t e = { 0.5*(zk.re + zc.re), 0.5*(zk.im + zc.im) };
+    const spectrum_complex_t o = { 0.5*(zk.im - zc.im), -0.5*(zk.re - zc.re) };
+    const spectrum_complex_t t = cmul(plan->rtw[k], o);
+    out[k].re = e.re + t.re;
+    out[k].im = e.im + t.im;
+  }
+}
+
+
+/* documented in spectrum.h */
+bool spectrum_parse_opt(spectrum_opt_t *opt, const char *str)
+{
+  char name[16];
+  memset(opt, 0, sizeof(*opt));
+  opt->window = WINDOW_HANN;
+  opt->zeropad = 1;
+
+  const size_t len = strcspn(str, ",");
+  if ((len == 0) || (len >= sizeof(name))) {
+    return false;
+  }
+  memcpy(name, str, len);
+  name[len] = '\0';
+  size_t w;
+  for (w = 0; w < sizeof(window_names)/sizeof(window_names[0]); w++) {
+    if (strcasecmp(name, window_names[w]) == 0) {
+      break;
+    }
+  }
+  if (w == sizeof(window_names)/sizeof(window_names[0])) {
+    return false;
+  }
+  opt->window = (spectrum_window_t)w;
+
+  const char *p = str + len;
+  char *end;
+  if (*p == ',') {
+    opt->segment = strtoul(p + 1, &end, 10);
+    p = end;
+  }
+  if (*p == ',') {
+    opt->zeropad = strtoul(p + 1, &end, 10);
+    p = end;
+    if (opt->zeropad < 1) {
+      return false;
+    }
+  }
+  if (*p == ',') {
+    if (strcmp(p + 1, "bin") == 0) {
+      opt->binary = true;
+      p += 4;
+    } else if (strcmp(p + 1, "csv") == 0) {
+      p += 4;
+    }
+  }
+  return (*p == '\0');
+}
+
+
+/** (Re)build the window and the FFT for segments of seglen samples */
+static void spectrum_setup(spectrum_t *spec, const size_t seglen)
+{
+  const size_t nfft = rfft_fast_size(seglen*spec->opt.zeropad);
+  if (nfft != spec->nfft) {
+    rfft_plan_free(spec->plan);
+    free(spec->work);
+    free(spec->bins);
+    free(spec->power);
+    spec->nfft = nfft;
+    spec->nbins = nfft/2 + 1;
+    spec->plan = rfft_plan_create(nfft);
+    spec->work = xmalloc(nfft*sizeof(double));
+    spec->bins = xmalloc(spec->nbins*sizeof(spectrum_complex_t));
+    spec->power = xmalloc(spec->nbins*sizeof(double));
+    memset(spec->power, 0, spec->nbins*sizeof(double));
+  }
+  free(spec->window);
+  spec->seglen = seglen;
+  spec->window = xmalloc(seglen*sizeof(double));
+  for (size_t i = 0; i < seglen; i++) {
+    /* periodic windows */
+    const double x = 2.0*M_PI*(double)i/(double)seglen;
+    switch (spec->opt.window) {
+      case WINDOW_HANN:     spec->window[i] = 0.5 - 0.5*cos(x); break;
+      case WINDOW_HAMMING:  spec->window[i] = 0.54 - 0.46*cos(x); break;
+      case WINDOW_BLACKMAN: spec->window[i] = 0.42 - 0.5*cos(x) + 0.08*cos(2.0*x); break;
+      case WINDOW_FLATTOP:
+        spec->window[i] = 0.21557895 - 0.41663158*cos(x) + 0.277263158*cos(2.0*x)
+                          - 0.083578947*cos(3.0*x) + 0.006947368*cos(4.0*x);
+        break;
+      default:              spec->window[i] = 1.0; break;
+    }
+  }
+}
+
+
+/* documented in spectrum.h */
+void spectrum_init(spectrum_t *spec, const spectrum_opt_t *opt,
+                   const double sample_rate, const size_t num_samples)
+{
+  memset(spec, 0, sizeof(*spec));
+  spec->opt = *opt;
+  spec->sample_rate = sample_rate;
+  size_t seglen = opt->segment;
+  if ((seglen == 0) || ((num_samples > 0) && (seglen > num_samples))) {
+    seglen = num_samples;
+  }
+  if (seglen < 2) {
+    seglen = 2;
+  }
+  spectrum_setup(spec, seglen);
+  spec->seg = xmalloc(seglen*sizeof(double));
+}
+
+
+/** Window, transform and accumulate the first n values of the segment buffer */
+static void spectrum_segment(spectrum_t *spec, const size_t n)
+{
+  for (size_t i = 0; i < n; i++) {
+    spec->work[i] = spec->seg[i]*spec->window[i];
+  }
+  memset(spec->work + n, 0, (spec->nfft - n)*sizeof(double));
+  rfft_execute(spec->plan, spec->work, spec->bins);
+  for (size_t k = 0; k < spec->nbins; k++) {
+    spec->power[k] += spec->bins[k].re*spec->bins[k].re + spec->bins[k].im*spec->bins[k].im;
+  }
+  spec->segments++;
+}
+
+
+/* documented in spectrum.h */
+void spectrum_feed(spectrum_t *spec, const double *v, size_t n)
+{
+  /* whole trace: no overlap, Welch: 50% overlap */
+  const size_t hop = (spec->opt.segment == 0) ? spec->seglen : (spec->seglen + 1)/2;
+  while (n > 0) {
+    size_t chunk = spec->seglen - spec->fill;
+    if (chunk > n) {
+      chunk = n;
+    }
+    memcpy(spec->seg + spec->fill, v, chunk*sizeof(double));
+    spec->fill += chunk;
+    v += chunk;
+    n -= chunk;
+    if (spec->fill == spec->seglen) {
+      spectrum_segment(spec, spec->seglen);
+      memmove(spec->seg, spec->seg + hop, (spec->seglen - hop)*sizeof(double));
+      spec->fill = spec->seglen - hop;
+    }
+  }
+}
+
+
+/* documented in spectrum.h */
+void spectrum_finish(spectrum_t *spec)
+{
+  /* trace shorter than one segment: use what is there */
+  if ((spec->segments == 0) && (spec->fill >= 2)) {
+    const size_t fill = spec->fill;
+    spectrum_setup(spec, fill);
+    spectrum_segment(spec, fill);
+  }
+  spec->fill = 0;
+}
+
+
+/* documented in spectrum.h */
+bool spectrum_save(const spectrum_t *spec, const char *file)
+{
+  double wsum = 0.0, w2sum = 0.0;
+  for (size_t i = 0; i < spec->seglen; i++) {
+    wsum += spec->window[i];
+    w2sum += spec->window[i]*spec->window[i];
+  }
+  const size_t segments = (spec->segments > 0) ? spec->segments : 1;
+  const double df = 1.0/((double)spec->nfft*spec->sample_rate);
+
+  FILE *fd = fopen(file, "w");
+  if (fd == NULL) {
+    return false;
+  }
+  if (!spec->opt.binary) {
+    fprintf(fd, "#Spectrum:\n");
+    fprintf(fd, "#Window:            \t%s\n", window_names[spec->opt.window]);
+    fprintf(fd, "#Segment length:    \t%zu\n", spec->seglen);
+    fprintf(fd, "#FFT length:        \t%zu\n", spec->nfft);
+    fprintf(fd, "#Averaged segments: \t%zu\n", spec->segments);
+    fprintf(fd, "#Bin width:         \t%.7e\n", df);
+    fprintf(fd, "#Frequency [Hz] \t Magnitude [V] \t PSD [V^2/Hz]\n");
+  }
+  for (size_t k = 0; k < spec->nbins; k++) {
+    /* single sided: all bins except DC and Nyquist carry both halves */
+    const double side = ((k == 0) || (k == spec->nbins - 1)) ? 1.0 : 2.0;
+    const double power = spec->power[k]/(double)segments;
+    double row[3];
+    row[0] = (double)k*df;
+    row[1] = side*sqrt(power)/wsum;
+    row[2] = side*power*spec->sample_rate/w2sum;
+    if (spec->opt.binary) {
+      fwrite(row, sizeof(double), 3, fd);
+    } else {
+      fprintf(fd, "%.7e \t %.7e \t %.7e\n", row[0], row[1], row[2]);
+    }
+  }
+  return (fclose(fd) == 0);
+}
+
+
+/* documented in spectrum.h */
+void spectrum_free(spectrum_t *spec)
+{
+  rfft_plan_free(spec->plan);
+  free(spec->power);
+  free(spec->seg);
+  free(spec->window);
+  free(spec->work);
+  free(spec->bins);
+  memset(spec, 0, sizeof(*spec));
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
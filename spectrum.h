@@ -0,0 +1,149 @@
+/** \file spectrum.h
+ * \brief Spectrum analysis (real FFT, windowing, Welch averaging) interface
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup spectrum
+ * @{
+ */
+
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/** Window functions applied to each segment */
+typedef enum {
+  WINDOW_RECT,
+  WINDOW_HANN,
+  WINDOW_HAMMING,
+  WINDOW_BLACKMAN,
+  WINDOW_FLATTOP
+} spectrum_window_t;
+
+
+/** Spectrum settings as given on the command line */
+typedef struct {
+  spectrum_window_t window;
+  /** segment length in samples, 0 for the whole trace */
+  size_t segment;
+  /** zero padding factor, the FFT length is at least segment*zeropad */
+  unsigned int zeropad;
+  /** write binary instead of CSV */
+  bool binary;
+} spectrum_opt_t;
+
+
+/** Complex number used by the FFT */
+typedef struct {
+  double re;
+  double im;
+} spectrum_complex_t;
+
+
+/** Precomputed real FFT of one length (opaque) */
+typedef struct rfft_plan rfft_plan_t;
+
+
+/** Smallest FFT length >= n the mixed radix FFT handles (even, n/2 = 2^a*3^b*5^c) */
+size_t rfft_fast_size(const size_t n);
+
+
+/** Create a real FFT plan, n has to be a value returned by rfft_fast_size() */
+rfft_plan_t *rfft_plan_create(const size_t n);
+
+
+/** Release a plan */
+void rfft_plan_free(rfft_plan_t *plan);
+
+
+/** Forward real FFT.
+ *
+ * \param plan plan of length n
+ * \param in n real input values
+ * \param out n/2+1 complex output bins (DC up to Nyquist)
+ */
+void rfft_execute(rfft_plan_t *plan, const double *in, spectrum_complex_t *out);
+
+
+/** Averaged spectrum (Welch's method, 50% segment overlap) */
+typedef struct {
+  spectrum_opt_t opt;
+  /** time between two samples in seconds */
+  double sample_rate;
+  /** FFT length */
+  size_t nfft;
+  /** number of output bins (nfft/2+1) */
+  size_t nbins;
+  /** number of averaged segments */
+  size_t segments;
+  /** accumulated |X|^2 per bin */
+  double *power;
+  rfft_plan_t *plan;
+  /* segment assembly */
+  size_t seglen;
+  size_t fill;
+  double *seg;
+  double *window;
+  double *work;
+  spectrum_complex_t *bins;
+} spectrum_t;
+
+
+/** Parse "window[,segment[,zeropad[,bin]]]", window is one of rect,
+ *  hann, hamming, blackman or flattop */
+bool spectrum_parse_opt(spectrum_opt_t *opt, const char *str);
+
+
+/** Prepare a spectrum for a trace of num_samples samples */
+void spectrum_init(spectrum_t *spec, const spectrum_opt_t *opt,
+                   const double sample_rate, const size_t num_samples);
+
+
+/** Feed the next n voltages of the trace */
+void spectrum_feed(spectrum_t *spec, const double *v, size_t n);
+
+
+/** Process a pending partial segment (zero padded) */
+void spectrum_finish(spectrum_t *spec);
+
+
+/** Write frequency, peak amplitude (V) and PSD (V^2/Hz) per bin.
+ *
+ * The binary format consists of nbins triplets of native doubles.
+ */
+bool spectrum_save(const spectrum_t *spec, const char *file);
+
+
+/** Release the memory of a spectrum */
+void spectrum_free(spectrum_t *spec);
+
+
+/** @} */
+
+#endif /* !SPECTRUM_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,171 @@
+/** \file synth.c
+ * \brief Synthetic FAMOS track file generator
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup synth Synthetic track files
+ *
+ * Track files of any length for benchmarks and for trying out the
+ * conversions without an instrument. The records are written the way
+ * the DSO writes them, the codes are clipped to 1..255 (0x00 is the
+ * out of range code of the scope).
+ *
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "synth.h"
+
+
+static const char * const shape_names[] = {
+  "sine", "square", "triangle", "ramp", "pulse", "noise"
+};
+
+
+/* documented in synth.h */
+bool synth_parse_opt(synth_opt_t *opt, const char *str)
+{
+  memset(opt, 0, sizeof(*opt));
+  opt->num_samples = 20000;
+  opt->sample_rate = 1e-6;
+  opt->mesial_voltage = 1.28;
+  opt->frequency = 1e3;
+  opt->amplitude = 1.0;
+  opt->seed = 1;
+
+  const size_t len = strcspn(str, ",");
+  size_t i;
+  for (i = 0; i < sizeof(shape_names)/sizeof(shape_names[0]); i++) {
+    if ((strlen(shape_names[i]) == len) && (strncmp(str, shape_names[i], len) == 0)) {
+      break;
+    }
+  }
+  if (i == sizeof(shape_names)/sizeof(shape_names[0])) {
+    return false;
+  }
+  opt->shape = (synth_shape_t)i;
+  str += len;
+
+  double *values[] = { NULL, &opt->sample_rate, &opt->frequency, &opt->amplitude, &opt->noise };
+  for (size_t k = 0; (k < sizeof(values)/sizeof(values[0])) && (*str == ','); k++) {
+    char *end;
+    str++;
+    if (k == 0) {
+      opt->num_samples = strtoul(str, &end, 10);
+    } else {
+      *values[k] = strtod(str, &end);
+    }
+    if ((end == str) || ((*end != ',') && (*end != '\0'))) {
+      return false;
+    }
+    str = end;
+  }
+  if (opt->num_samples > SYNTH_MAX_SAMPLES) {
+    printf("synth: at most %d samples fit into a track file\n", SYNTH_MAX_SAMPLES);
+    return false;
+  }
+  return (*str == '\0') && (opt->num_samples > 0) && (opt->sample_rate > 0.0);
+}
+
+
+/** xorshift32, the same sequence on every machine */
+static uint32_t next_random(uint32_t *state)
+{
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+
+/** Gaussian random number with unit variance (Box-Muller) */
+static double gauss(uint32_t *state)
+{
+  const double u1 = ((double)next_random(state) + 1.0)/4294967297.0;
+  const double u2 = (double)next_random(state)/4294967296.0;
+  return sqrt(-2.0*log(u1))*cos(2.0*M_PI*u2);
+}
+
+
+/** Signal in volts at time t */
+static double waveform(const synth_opt_t *opt, const double t, uint32_t *state)
+{
+  double phase = opt->frequency*t;
+  phase -= floor(phase);
+  switch (opt->shape) {
+    case SYNTH_SINE:     return opt->amplitude*sin(2.0*M_PI*phase);
+    case SYNTH_SQUARE:   return (phase < 0.5) ? opt->amplitude : -opt->amplitude;
+    case SYNTH_TRIANGLE: return opt->amplitude*((phase < 0.5) ? 4.0*phase - 1.0 : 3.0 - 4.0*phase);
+    case SYNTH_RAMP:     return opt->amplitude*(2.0*phase - 1.0);
+    case SYNTH_PULSE:    return (phase < 0.1) ? opt->amplitude : 0.0;
+    default:             return opt->amplitude*gauss(state);
+  }
+}
+
+
+/* documented in synth.h */
+char *synth_famos(const synth_opt_t *opt, size_t *count)
+{
+  char header[512];
+  const int hlen = snprintf(header, sizeof(header),
+                            "|CF,2,1,1;|CD,1,%.7E,1,%.7E,1,1,s;"
+                            "|CR,1,1,0,1,0.,255.,0.,255.,%.7E,%.7E,1,1,V;"
+                            "|NT,1,1,19.10.2017,1,12:00:00;|NL,1,DSO 650;|CS,1,%zu,",
+                            opt->sample_rate, opt->trigger_delay,
+                            opt->mesial_voltage, opt->offset_voltage, opt->num_samples);
+  const char footer[] = ";|CA,1,0000000000;";
+
+  *count = (size_t)hlen + opt->num_samples + sizeof(footer) - 1;
+  char *buf = malloc(*count);
+  if (buf == NULL) {
+    return NULL;
+  }
+  memcpy(buf, header, (size_t)hlen);
+  uint8_t *codes = (uint8_t *)buf + hlen;
+  uint32_t state = (opt->seed != 0) ? opt->seed : 1;
+  const double scale = 128.0/opt->mesial_voltage;
+  for (size_t i = 0; i < opt->num_samples; i++) {
+    const double t = (double)i*opt->sample_rate - opt->trigger_delay;
+    double v = waveform(opt, t, &state);
+    if (opt->noise > 0.0) {
+      v += opt->noise*gauss(&state);
+    }
+    const double code = round(128.0 + (v + opt->offset_voltage)*scale);
+    codes[i] = (code < 1.0) ? 1 : ((code > 255.0) ? 255 : (uint8_t)code);
+  }
+  memcpy(codes + opt->num_samples, footer, sizeof(footer) - 1);
+  return buf;
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,96 @@
+/** \file synth.h
+ * \brief Synthetic FAMOS track file generator interface
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup synth
+ * @{
+ */
+
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "famos.h"
+
+
+/** Most samples of a synthetic trace, the track file including the
+ *  records around the codes has to stay below FAMOS_MAX_FILE_SIZE */
+#define SYNTH_MAX_SAMPLES (FAMOS_MAX_FILE_SIZE - 1024)
+
+
+/** Waveform of a synthetic trace */
+typedef enum {
+  SYNTH_SINE,
+  SYNTH_SQUARE,
+  SYNTH_TRIANGLE,
+  SYNTH_RAMP,
+  SYNTH_PULSE,
+  SYNTH_NOISE
+} synth_shape_t;
+
+
+/** Setup of a synthetic trace (see synth_parse_opt()) */
+typedef struct {
+  synth_shape_t shape;
+  size_t num_samples;
+  /** CD record */
+  double sample_rate;
+  double trigger_delay;
+  /** CR record */
+  double mesial_voltage;
+  double offset_voltage;
+  /** signal frequency in Hz and amplitude in volts */
+  double frequency;
+  double amplitude;
+  /** rms of the added gaussian noise in volts */
+  double noise;
+  /** seed of the noise, equal seeds give equal files */
+  unsigned int seed;
+} synth_opt_t;
+
+
+/** Parse "shape[,samples[,rate[,frequency[,amplitude[,noise]]]]]".
+ *
+ * shape is sine, square, triangle, ramp, pulse (10% duty cycle) or noise,
+ * missing entries keep their defaults (1 kHz, 1 V at 1 us, 0.64 V/div).
+ */
+bool synth_parse_opt(synth_opt_t *opt, const char *str);
+
+
+/** Build a track file with CF/CD/CR/NT/NL/CS/CA records.
+ *
+ * \param count size of the returned buffer
+ * \return track file (to be freed) or NULL if out of memory
+ */
+char *synth_famos(const synth_opt_t *opt, size_t *count);
+
+
+/** @} */
+
+#endif /* !SYNTH_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
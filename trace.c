@@ -0,0 +1,218 @@
+/** \file trace.c
+ * \brief Loading of track files (raw FAMOS or converted CSV)
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup trace Track file loading
+ * @{
+ */
+
+#define _GNU_SOURCE /* memmem() */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+
+
+/** Read a whole file into a null terminated buffer */
+static char *read_file(const char *file, size_t *count)
+{
+  FILE *fd = fopen(file, "r");
+  if (fd == NULL) {
+    printf("cannot open %s\n", file);
+    return NULL;
+  }
+  fseek(fd, 0, SEEK_END);
+  const long size = ftell(fd);
+  rewind(fd);
+  char *buf = (size >= 0) ? malloc((size_t)size + 1) : NULL;
+  if (buf == NULL) {
+    printf("cannot read %s\n", file);
+    fclose(fd);
+    return NULL;
+  }
+  *count = fread(buf, 1, (size_t)size, fd);
+  buf[*count] = '\0';
+  fclose(fd);
+  return buf;
+}
+
+
+/** Value of a "#Key: <tab> value" header line, returns false if missing */
+static bool csv_header_value(const char *buf, const char *key, double *value)
+{
+  const char *p = strstr(buf, key);
+  if (p == NULL) {
+    return false;
+  }
+  *value = strtod(p + strlen(key), NULL);
+  return true;
+}
+
+
+/** Parse the time and the voltage of a CSV line, false for comments */
+static bool csv_sample(const char *p, double *t, double *v)
+{
+  if (*p == '#') {
+    return false;
+  }
+  char *end, *end2;
+  *t = strtod(p, &end);
+  if (end == p) {
+    return false;
+  }
+  *v = strtod(end, &end2);
+  return (end2 != end);
+}
+
+
+/** Start of the line following p */
+static const char *next_line(const char *p)
+{
+  const char *eol = strchr(p, '\n');
+  return (eol == NULL) ? p + strlen(p) : eol + 1;
+}
+
+
+/** Count the samples of a CSV file and take the setup from its header */
+static bool scan_csv(trace_data_t *td)
+{
+  famos_trace_t *h = &td->header;
+  double t0 = 0.0, t1 = 0.0;
+
+  for (const char *p = td->raw; *p != '\0'; p = next_line(p)) {
+    double t, v;
+    if (csv_sample(p, &t, &v)) {
+      if (td->n == 0) {
+        t0 = t;
+      } else if (td->n == 1) {
+        t1 = t;
+      }
+      td->n++;
+    }
+  }
+
+  h->has_xaxis = csv_header_value(td->raw, "#Samplerate:", &h->sample_rate) &&
+                 csv_header_value(td->raw, "#Trigger delay:", &h->trigger_delay);
+  if (!h->has_xaxis) {
+    /* plain two column file: take the axis from the time column */
+    h->has_xaxis = true;
+    h->sample_rate = (td->n > 1) ? (t1 - t0) : 1.0;
+    h->trigger_delay = -t0;
+  }
+  h->has_yaxis = csv_header_value(td->raw, "#Mesial voltage:", &h->mesial_voltage) &&
+                 csv_header_value(td->raw, "#Offset in volts:", &h->offset_voltage);
+  h->timebase = strstr(td->raw, "DSO timebase") ? 1 : (strstr(td->raw, "Ext clock") ? 0 : -1);
+  h->variable_volts = strstr(td->raw, "#Variable volts/div off") ? 1 :
+                      (strstr(td->raw, "#Variable volts/div on") ? 0 : -1);
+  h->num_samples = td->n;
+  td->cursor = td->raw;
+  td->cursor_index = 0;
+  return (td->n > 0);
+}
+
+
+/* documented in trace.h */
+bool trace_open(trace_data_t *td, const char *file)
+{
+  memset(td, 0, sizeof(*td));
+  td->raw = read_file(file, &td->raw_count);
+  if (td->raw == NULL) {
+    return false;
+  }
+
+  bool ok;
+  if (memmem(td->raw, td->raw_count, "|CS,1,", 6) != NULL) {
+    ok = famos_parse(td->raw, td->raw_count, &td->header) && (td->header.num_samples > 0);
+    td->n = td->header.num_samples;
+  } else {
+    ok = scan_csv(td);
+  }
+  if (!ok) {
+    printf("%s: no samples found\n", file);
+    trace_free(td);
+  }
+  return ok;
+}
+
+
+/* documented in trace.h */
+void trace_fetch(trace_data_t *td, const size_t first, const size_t n, double *v)
+{
+  if (td->header.samples != NULL) {
+    for (size_t i = 0; i < n; i++) {
+      v[i] = famos_voltage(&td->header, td->header.samples[first + i]);
+    }
+    return;
+  }
+  /* CSV lines are parsed on from the last sample fetched */
+  if (first < td->cursor_index) {
+    td->cursor = td->raw;
+    td->cursor_index = 0;
+  }
+  size_t k = 0;
+  while ((k < n) && (*td->cursor != '\0')) {
+    double t, value;
+    if (csv_sample(td->cursor, &t, &value)) {
+      if (td->cursor_index >= first) {
+        v[k++] = value;
+      }
+      td->cursor_index++;
+    }
+    td->cursor = next_line(td->cursor);
+  }
+}
+
+
+/* documented in trace.h */
+bool trace_load(trace_data_t *td, const char *file)
+{
+  if (!trace_open(td, file)) {
+    return false;
+  }
+  td->v = malloc(td->n*sizeof(double));
+  if (td->v == NULL) {
+    printf("%s: out of memory\n", file);
+    trace_free(td);
+    return false;
+  }
+  trace_fetch(td, 0, td->n, td->v);
+  return true;
+}
+
+
+/* documented in trace.h */
+void trace_free(trace_data_t *td)
+{
+  free(td->v);
+  free(td->raw);
+  memset(td, 0, sizeof(*td));
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
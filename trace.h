@@ -0,0 +1,100 @@
+/** \file trace.h
+ * \brief Loading of track files (raw FAMOS or converted CSV) interface
+ *
+ * \author Copyright (C) 2017 samplemaker
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup trace
+ * @{
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "famos.h"
+
+
+/** A trace read from disc, see trace_load() and trace_open() */
+typedef struct {
+  /** header fields, header.samples points into raw for FAMOS files
+   *  and is NULL for CSV files */
+  famos_trace_t header;
+  /** voltage of every sample, NULL if opened with trace_open() */
+  double *v;
+  /** number of samples */
+  size_t n;
+  /** file content */
+  char *raw;
+  size_t raw_count;
+  /** CSV files: next line to parse and its sample number */
+  const char *cursor;
+  size_t cursor_index;
+} trace_data_t;
+
+
+/** Load a FAMOS track file (.dat) or a CSV file written by the converter.
+ *
+ * CSV files without a "#Samplerate:" header get the sample rate and the
+ * trigger delay from the time column.
+ *
+ * \return false if the file cannot be read or contains no samples
+ */
+bool trace_load(trace_data_t *td, const char *file);
+
+
+/** Read the setup of a track file like trace_load() but decode no voltage.
+ *
+ * The samples are decoded on demand with trace_fetch().
+ *
+ * \return false if the file cannot be read or contains no samples
+ */
+bool trace_open(trace_data_t *td, const char *file);
+
+
+/** Decode the voltages of the samples [first, first+n) into v.
+ *
+ * CSV files are parsed on from the previous fetch, hence the samples
+ * should be requested in ascending order.
+ */
+void trace_fetch(trace_data_t *td, const size_t first, const size_t n, double *v);
+
+
+/** Release the memory of a loaded trace */
+void trace_free(trace_data_t *td);
+
+
+/** Position of time t on the sample axis of a trace (fractional index) */
+static inline double trace_index(const famos_trace_t *header, const double t)
+{
+  return (t + header->trigger_delay)/header->sample_rate;
+}
+
+
+/** @} */
+
+#endif /* !TRACE_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */